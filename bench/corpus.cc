@@ -0,0 +1,159 @@
+#include <corpus.hh>
+
+using namespace dict;
+using namespace dict::bench;
+
+namespace {
+/// SplitMix64; we don’t use <random> since the distributions in there
+/// aren’t guaranteed to produce the same values on every platform.
+class Random {
+    u64 state;
+
+public:
+    explicit Random(u64 seed) : state{seed} {}
+
+    auto next() -> u64 {
+        u64 z = (state += 0x9E37'79B9'7F4A'7C15);
+        z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+        z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+        return z ^ (z >> 31);
+    }
+
+    /// Get a number in [0, 1).
+    auto uniform() -> double { return double(next() >> 11) * 0x1p-53; }
+
+    /// Get a number in [0, n).
+    auto below(usz n) -> usz { return usz(next() % n); }
+
+    /// Return true with probability 'p'.
+    auto chance(double p) -> bool { return uniform() < p; }
+
+    /// Get a count whose average is 'mean'.
+    auto count(double mean) -> usz { return usz(uniform() * 2 * mean + .5); }
+
+    /// Pick an element of a range.
+    template <typename T, usz n>
+    auto pick(const T (&range)[n]) -> const T& { return range[below(n)]; }
+};
+
+constexpr str Onsets[]{"", "b", "d", "f", "g", "k", "l", "m", "n", "p", "r", "s", "t", "v", "z", "ch", "sh", "tr", "pl", "gr", "ł"};
+constexpr str Nuclei[]{"a", "e", "i", "o", "u", "á", "é", "è", "ô", "ou", "ai", "ẹ", "y"};
+constexpr str Codas[]{"", "", "", "n", "r", "s", "t", "l", "ç", "m"};
+constexpr str PartsOfSpeech[]{"n.", "v.", "adj.", "adv.", "prep.", "n. f.", "n. m.", "v. t.", "v. i."};
+constexpr str Etymologies[]{"", "", "\\w{ancient}", "from \\s{lat} \\textit{verbum}", "← \\w{other} + \\w{word}", "?"};
+constexpr str Words[]{
+    "to", "be", "make", "a", "the", "of", "thing", "person", "which", "is", "that", "go", "with", "in",
+    "large", "small", "house", "water", "fire", "light", "(figuratively)", "especially", "kind", "some",
+    "bring", "life", "animate", "speak", "say", "tell", "one’s", "own", "used", "for", "(archaic)",
+};
+
+void AppendSyllables(Random& rng, std::string& out, usz min, usz max) {
+    for (usz i = 0, n = min + rng.below(max - min + 1); i < n; i++) {
+        out += rng.pick(Onsets);
+        out += rng.pick(Nuclei);
+        out += rng.pick(Codas);
+    }
+}
+
+auto Headword(Random& rng) -> std::string {
+    std::string word;
+    AppendSyllables(rng, word, 1, 4);
+    if (rng.chance(.05)) {
+        word += rng.chance(.5) ? " " : "-";
+        AppendSyllables(rng, word, 1, 2);
+    }
+    return word;
+}
+
+void AppendText(Random& rng, std::string& out, const CorpusOptions& opts, usz min_words) {
+    auto words = min_words + rng.below(8);
+    auto macros = rng.count(opts.macros);
+    for (usz i = 0; i < words; i++) {
+        if (i != 0) out += ' ';
+        if (macros and rng.chance(double(macros) / double(words - i))) {
+            macros--;
+            switch (rng.below(8)) {
+                case 0: out += "\\s{"; out += rng.pick(Words); out += "}"; break;
+                case 1: out += "\\w{"; AppendSyllables(rng, out, 1, 3); out += "}"; break;
+                case 2: out += "\\textit{"; out += rng.pick(Words); out += "}"; break;
+                case 3: out += "\\textbf{"; out += rng.pick(Words); out += "}"; break;
+                case 4: out += "\\this"; break;
+                case 5: out += "\\ldots{}"; break;
+                case 6: out += "$x^2$"; break;
+                case 7: out += rng.pick(Words); out += "\\-"; out += rng.pick(Words); break;
+                default: Unreachable();
+            }
+            continue;
+        }
+
+        out += rng.pick(Words);
+    }
+}
+
+void AppendSense(Random& rng, std::string& out, const CorpusOptions& opts) {
+    AppendText(rng, out, opts, 2);
+    if (rng.chance(.1)) {
+        out += " \\comment ";
+        AppendText(rng, out, opts, 1);
+    }
+
+    for (usz i = 0, n = rng.count(opts.examples); i < n; i++) {
+        out += " \\ex ";
+        AppendText(rng, out, opts, 3);
+        if (rng.chance(.1)) {
+            out += " \\comment ";
+            AppendText(rng, out, opts, 1);
+        }
+    }
+}
+}
+
+auto CorpusOptions::to_json() const -> nlohmann::json {
+    return nlohmann::json{
+        {"entries", entries},
+        {"senses", senses},
+        {"examples", examples},
+        {"macros", macros},
+        {"refs", refs},
+        {"seed", seed},
+    };
+}
+
+auto bench::GenerateCorpus(const CorpusOptions& opts) -> std::string {
+    Random rng{opts.seed};
+    std::vector<std::string> headwords;
+    std::string out;
+    out.reserve(opts.entries * 160);
+    for (usz i = 0; i < opts.entries; i++) {
+        auto word = Headword(rng);
+
+        // References need something to refer to.
+        if (not headwords.empty() and rng.chance(opts.refs)) {
+            out += std::format("{} > {}", word, headwords[rng.below(headwords.size())]);
+            if (rng.chance(.2)) out += std::format(", {}", headwords[rng.below(headwords.size())]);
+            out += '\n';
+            continue;
+        }
+
+        // Full entry.
+        out += std::format("{}|{}|{}|", word, rng.pick(PartsOfSpeech), rng.pick(Etymologies));
+        AppendSense(rng, out, opts);
+        for (usz j = 0, n = rng.count(opts.senses); j < n; j++) {
+            // Put some of the senses on continuation lines.
+            out += rng.chance(.5) ? "\n    \\\\ " : " \\\\ ";
+            AppendSense(rng, out, opts);
+        }
+
+        bool ipa = rng.chance(.2);
+        if (rng.chance(.3)) out += "|pl. \\w{" + word + "s}";
+        else if (ipa) out += '|';
+        if (ipa) out += "|" + word;
+        out += '\n';
+
+        // Occasionally add a comment.
+        if (rng.chance(.01)) out += "# comment\n";
+        headwords.push_back(std::move(word));
+    }
+
+    return out;
+}
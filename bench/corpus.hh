@@ -0,0 +1,42 @@
+#ifndef DICTIONARY_GENERATOR_BENCH_CORPUS_HH
+#define DICTIONARY_GENERATOR_BENCH_CORPUS_HH
+
+#include <base/Base.hh>
+#include <nlohmann/json.hpp>
+
+namespace dict::bench {
+using namespace base;
+
+/// Parameters for a synthetic dictionary.
+struct CorpusOptions {
+    /// Number of entries, including references.
+    usz entries = 80'000;
+
+    /// Average number of senses per full entry, excluding the primary
+    /// definition.
+    double senses = 1.5;
+
+    /// Average number of examples per sense.
+    double examples = 0.5;
+
+    /// Average number of macros per definition, sense, or example.
+    double macros = 1.5;
+
+    /// Fraction of entries that are references.
+    double refs = 0.15;
+
+    /// Seed for the random number generator.
+    u64 seed = 42;
+
+    /// Convert these options to JSON so they can be stored with the results.
+    [[nodiscard]] auto to_json() const -> nlohmann::json;
+};
+
+/// Generate a synthetic dictionary.
+///
+/// The output only depends on the options, so the same options always
+/// yield the same corpus, on every platform.
+[[nodiscard]] auto GenerateCorpus(const CorpusOptions& opts) -> std::string;
+} // namespace dict::bench
+
+#endif // DICTIONARY_GENERATOR_BENCH_CORPUS_HH
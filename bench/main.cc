@@ -0,0 +1,437 @@
+#include <corpus.hh>
+#include <dictgen/backends.hh>
+#include <dictgen/frontend.hh>
+#include <dictgen/scan.hh>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <print>
+
+using namespace dict;
+using namespace dict::bench;
+using Clock = std::chrono::steady_clock;
+
+// Count every heap allocation so we can report allocations per run.
+static std::atomic<u64> Allocations = 0;
+
+auto operator new(std::size_t size) -> void* {
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+struct BenchOps : LanguageOps {
+    auto sort_key(str32 word, str32 nfkd) -> std::optional<std::string> override {
+        return DefaultSortKey(word, nfkd);
+    }
+
+    auto to_ipa(str s) -> Result<std::string> override {
+        return std::format("/{}/", s);
+    }
+};
+
+struct Options {
+    CorpusOptions corpus;
+    usz iterations = 5;
+    usz threads = 1;
+    std::string filter;
+    std::string output;
+    std::string baseline;
+    double tolerance = .1;
+};
+
+struct Measurement {
+    std::string name;
+    std::vector<i64> samples_ns;
+
+    /// Heap allocations during the last run.
+    u64 allocations = 0;
+
+    /// Number of items processed per run, if that’s meaningful.
+    usz items = 0;
+
+    [[nodiscard]] auto median() const -> i64 {
+        auto s = samples_ns;
+        rgs::sort(s);
+        return s[s.size() / 2];
+    }
+
+    [[nodiscard]] auto min() const -> i64 { return rgs::min(samples_ns); }
+};
+
+/// A benchmark.
+///
+/// 'setup' is run before every iteration and is not timed; 'run' is
+/// the part that is timed.
+struct Benchmark {
+    std::string name;
+    std::function<void()> setup;
+    std::function<void()> run;
+
+    /// Number of items processed per run, e.g. fields; if this is set,
+    /// allocations are also reported per item.
+    usz items = 0;
+};
+
+[[noreturn]] void Usage(std::string_view program) {
+    std::println(stderr, "Usage: {} [options]", program);
+    std::println(stderr, "Options:");
+    std::println(stderr, "    --entries <n>      Number of entries in the corpus (default: 80000)");
+    std::println(stderr, "    --senses <n>       Average number of senses per entry (default: 1.5)");
+    std::println(stderr, "    --examples <n>     Average number of examples per sense (default: 0.5)");
+    std::println(stderr, "    --macros <n>       Average number of macros per field (default: 1.5)");
+    std::println(stderr, "    --refs <n>         Fraction of entries that are references (default: 0.15)");
+    std::println(stderr, "    --seed <n>         Seed for the corpus generator (default: 42)");
+    std::println(stderr, "    --iterations <n>   Number of times to run each benchmark (default: 5)");
+    std::println(stderr, "    --threads <n>      Number of threads to use in the generator (default: 1)");
+    std::println(stderr, "    --filter <s>       Only run benchmarks whose name contains this string");
+    std::println(stderr, "    --output <path>    Write the results to this file as JSON");
+    std::println(stderr, "    --baseline <path>  Compare the results against a previous --output file");
+    std::println(stderr, "    --tolerance <n>    Fail if a benchmark is slower than the baseline by more");
+    std::println(stderr, "                       than this fraction (default: 0.1)");
+    std::println(stderr, "    --dump-corpus      Print the corpus and exit");
+    std::exit(1);
+}
+
+auto ParseOptions(int argc, char** argv, bool& dump_corpus) -> Options {
+    Options opts;
+    std::span args{argv, usz(argc)};
+    for (usz i = 1; i < args.size(); i++) {
+        str arg = args[i];
+        if (arg == "--help") Usage(args[0]);
+        if (arg == "--dump-corpus") {
+            dump_corpus = true;
+            continue;
+        }
+
+        if (i + 1 == args.size()) Usage(args[0]);
+        std::string value = args[++i];
+        auto Number = [&] { return std::stod(value); };
+        if (arg == "--entries") opts.corpus.entries = usz(Number());
+        else if (arg == "--senses") opts.corpus.senses = Number();
+        else if (arg == "--examples") opts.corpus.examples = Number();
+        else if (arg == "--macros") opts.corpus.macros = Number();
+        else if (arg == "--refs") opts.corpus.refs = Number();
+        else if (arg == "--seed") opts.corpus.seed = std::stoull(value);
+        else if (arg == "--iterations") opts.iterations = std::max<usz>(1, usz(Number()));
+        else if (arg == "--threads") opts.threads = std::max<usz>(1, usz(Number()));
+        else if (arg == "--filter") opts.filter = std::move(value);
+        else if (arg == "--output") opts.output = std::move(value);
+        else if (arg == "--baseline") opts.baseline = std::move(value);
+        else if (arg == "--tolerance") opts.tolerance = Number();
+        else Usage(args[0]);
+    }
+
+    return opts;
+}
+
+/// Collect every field of every full entry that would be converted from TeX.
+auto CollectFields(const std::vector<Entry>& entries) -> std::vector<str> {
+    std::vector<str> fields;
+    auto AddEntry = [&](const FullEntry& f) {
+        auto AddSense = [&](const FullEntry::Sense& s) {
+            fields.push_back(s.def);
+            if (not s.comment.empty()) fields.push_back(s.comment);
+            for (auto& ex : s.examples) {
+                fields.push_back(ex.text);
+                if (not ex.comment.empty()) fields.push_back(ex.comment);
+            }
+        };
+
+        fields.push_back(f.pos);
+        fields.push_back(f.etym);
+        AddSense(f.primary_definition);
+        for (auto& s : f.senses) AddSense(s);
+    };
+
+    for (auto& e : entries) e.data.visit(utils::Overloaded{
+        [](const RefEntry&) {},
+        AddEntry,
+    });
+
+    return fields;
+}
+
+/// Count the allocations that a tree with one heap allocation per node
+/// and per list of children would need.
+auto CountHeapTreeAllocations(const Node& n) -> u64 {
+    u64 count = 1;
+    if (auto c = n.as<ContentNode>()) {
+        if (not c->children.empty()) count++;
+        for (auto child : c->children) count += CountHeapTreeAllocations(*child);
+    } else if (auto m = n.as<MacroNode>()) {
+        for (auto arg : m->args) count += CountHeapTreeAllocations(*arg);
+    }
+
+    return count;
+}
+
+auto RunBenchmarks(const Options& opts, str corpus) -> std::vector<Measurement> {
+    BenchOps ops;
+    std::vector<Benchmark> benchmarks;
+    std::vector<Measurement> results;
+
+    // Parse the corpus once up front; most benchmarks need the entries.
+    std::vector<Entry> parsed;
+    {
+        JsonBackend backend{ops, false};
+        Generator gen{backend, opts.threads};
+        gen.parse(corpus);
+        parsed = std::move(gen.entries);
+    }
+
+    // State that is rebuilt by the setup functions.
+    std::unique_ptr<Backend> backend;
+    std::unique_ptr<Generator> gen;
+    auto Fresh = [&]<typename BackendType>(auto&&... args) {
+        gen.reset();
+        backend = Backend::New<BackendType>(ops, LIBBASE_FWD(args)...);
+        gen = std::make_unique<Generator>(*backend, opts.threads);
+    };
+
+    auto Parsed = [&]<typename BackendType>(auto&&... args) {
+        Fresh.operator()<BackendType>(LIBBASE_FWD(args)...);
+        gen->entries = parsed;
+        gen->sort_entries();
+    };
+
+    // Frontend.
+    benchmarks.emplace_back(
+        "parse",
+        [&] { Fresh.operator()<JsonBackend>(false); },
+        [&] { gen->parse(corpus); }
+    );
+
+    benchmarks.emplace_back(
+        "sort (sort keys)",
+        [&] { Fresh.operator()<JsonBackend>(false); gen->entries = parsed; },
+        [&] { gen->sort_entries(); }
+    );
+
+    benchmarks.emplace_back(
+        "sort (collate)",
+        [&] {
+            Fresh.operator()<JsonBackend>(false);
+            gen->entries = parsed;
+            for (auto& e : gen->entries) e.sort_key.reset();
+        },
+        [&] { gen->sort_entries(); }
+    );
+
+    // TeX parser.
+    auto fields = CollectFields(parsed);
+    benchmarks.emplace_back(
+        "TexParser::Parse",
+        [&] { Fresh.operator()<JsonBackend>(false); },
+        [&] {
+            for (auto f : fields) {
+                (void) TexParser::Parse(*backend, f);
+                backend->arena.reset();
+            }
+        },
+        fields.size()
+    );
+
+    // Scan every field the way the parser does, with every kernel that the
+    // CPU supports; this is the inner loop of the parser.
+    volatile usz scanned = 0;
+    for (auto& k : scan::Implementations()) {
+        benchmarks.emplace_back(
+            std::format("scan ({})", k.name),
+            [] {},
+            [&] {
+                usz found = 0;
+                for (auto f : fields) {
+                    auto p = f.data();
+                    for (usz i = 0; i < f.size(); i++, found++) {
+                        i += k.find_tex_special(p + i, f.size() - i);
+                        if (i < f.size() and p[i] == '\\') i += k.count_macro_letters(p + i + 1, f.size() - i - 1);
+                    }
+                }
+                scanned = found;
+            }
+        );
+    }
+
+    benchmarks.emplace_back(
+        "JsonBackend::tex_to_html",
+        [&] { Fresh.operator()<JsonBackend>(false); },
+        [&] {
+            auto& json = static_cast<JsonBackend&>(*backend);
+            json.current_word = "word";
+            for (auto f : fields) (void) json.tex_to_html(f);
+        },
+        fields.size()
+    );
+
+    // Backends.
+    auto Emit = [&] {
+        gen->emit_entries(*backend, nullptr);
+        backend->finish();
+    };
+
+    benchmarks.emplace_back("emit (json)", [&] { Parsed.operator()<JsonBackend>(false); }, Emit);
+    benchmarks.emplace_back("emit (json, minified)", [&] { Parsed.operator()<JsonBackend>(true); }, Emit);
+    benchmarks.emplace_back("emit (typst)", [&] { Parsed.operator()<TypstBackend>(); }, Emit);
+    benchmarks.emplace_back("emit (tex)", [&] { Parsed.operator()<TeXBackend>("corpus"); }, Emit);
+
+    // Every backend at once; this includes sorting the entries.
+    std::vector<std::unique_ptr<Backend>> all_backends;
+    benchmarks.emplace_back(
+        "emit (json, typst, tex)",
+        [&] {
+            gen.reset();
+            all_backends.clear();
+            all_backends.push_back(Backend::New<JsonBackend>(ops, false));
+            all_backends.push_back(Backend::New<TypstBackend>(ops));
+            all_backends.push_back(Backend::New<TeXBackend>(ops, "corpus"));
+            std::vector<Backend*> ptrs;
+            for (auto& b : all_backends) ptrs.push_back(b.get());
+            gen = std::make_unique<Generator>(ptrs, opts.threads);
+            gen->entries = parsed;
+        },
+        [&] { (void) gen->emit_all(); }
+    );
+
+    // Search normalisation.
+    benchmarks.emplace_back(
+        "JsonBackend::NormaliseForSearch",
+        [&] { Fresh.operator()<JsonBackend>(false); },
+        [&] {
+            auto& json = static_cast<JsonBackend&>(*backend);
+            for (auto& e : parsed) (void) json.NormaliseForSearch(e.word);
+        }
+    );
+
+    // Run them.
+    for (auto& b : benchmarks) {
+        if (not opts.filter.empty() and not b.name.contains(opts.filter)) continue;
+        auto& r = results.emplace_back(b.name);
+        r.items = b.items;
+        for (usz i = 0; i < opts.iterations; i++) {
+            b.setup();
+            auto allocations = Allocations.load(std::memory_order_relaxed);
+            auto start = Clock::now();
+            b.run();
+            auto end = Clock::now();
+            r.allocations = Allocations.load(std::memory_order_relaxed) - allocations;
+            r.samples_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+
+        std::print(
+            "{:<35} median {:>10.3f} ms    min {:>10.3f} ms    allocs {:>10}",
+            r.name,
+            double(r.median()) / 1e6,
+            double(r.min()) / 1e6,
+            r.allocations
+        );
+
+        if (r.items) std::print(" ({:.3f} per item)", double(r.allocations) / double(r.items));
+        std::println();
+    }
+
+    // For comparison: a tree with one heap allocation per node and one
+    // per list of children, like the parser built before it used an arena,
+    // would need at least this many allocations.
+    if (rgs::any_of(results, [](auto& r) { return r.name == "TexParser::Parse"; })) {
+        Fresh.operator()<JsonBackend>(false);
+        u64 heap_tree = 0;
+        for (auto f : fields) {
+            if (auto tree = TexParser::Parse(*backend, f)) heap_tree += CountHeapTreeAllocations(*tree.value());
+            backend->arena.reset();
+        }
+
+        std::println(
+            "{:<35} allocs {:>10} ({:.3f} per item)",
+            "TexParser::Parse (heap tree)",
+            heap_tree,
+            double(heap_tree) / double(std::max<usz>(fields.size(), 1))
+        );
+    }
+
+    return results;
+}
+
+auto ToJson(const Options& opts, const std::vector<Measurement>& results) -> json {
+    json j;
+    j["corpus"] = opts.corpus.to_json();
+    j["iterations"] = opts.iterations;
+    j["threads"] = opts.threads;
+    auto& benchmarks = j["benchmarks"] = json::object();
+    for (auto& r : results) {
+        benchmarks[r.name] = json{
+            {"median_ns", r.median()},
+            {"min_ns", r.min()},
+            {"samples_ns", r.samples_ns},
+            {"allocations", r.allocations},
+        };
+    }
+    return j;
+}
+
+/// Compare against a baseline; returns false if anything regressed.
+auto CompareToBaseline(const Options& opts, const std::vector<Measurement>& results) -> bool {
+    std::ifstream f{opts.baseline};
+    if (not f) {
+        std::println(stderr, "Could not open baseline '{}'", opts.baseline);
+        return false;
+    }
+
+    auto baseline = json::parse(f, nullptr, false);
+    if (baseline.is_discarded() or not baseline.contains("benchmarks")) {
+        std::println(stderr, "Baseline '{}' is not a valid results file", opts.baseline);
+        return false;
+    }
+
+    if (baseline["corpus"] != opts.corpus.to_json())
+        std::println(stderr, "Warning: baseline was generated with different corpus options");
+
+    bool ok = true;
+    std::println("\nCompared to baseline '{}':", opts.baseline);
+    for (auto& r : results) {
+        auto it = baseline["benchmarks"].find(r.name);
+        if (it == baseline["benchmarks"].end()) {
+            std::println("{:<35} (not in baseline)", r.name);
+            continue;
+        }
+
+        auto before = it->at("median_ns").get<double>();
+        auto ratio = double(r.median()) / before;
+        bool regressed = ratio > 1 + opts.tolerance;
+        ok = ok and not regressed;
+        std::println("{:<35} {:>+8.1f}%{}", r.name, (ratio - 1) * 100, regressed ? "    REGRESSED" : "");
+    }
+
+    return ok;
+}
+}
+
+int main(int argc, char** argv) {
+    bool dump_corpus = false;
+    auto opts = ParseOptions(argc, argv, dump_corpus);
+    auto corpus = GenerateCorpus(opts.corpus);
+    if (dump_corpus) {
+        std::print("{}", corpus);
+        return 0;
+    }
+
+    auto results = RunBenchmarks(opts, corpus);
+    if (not opts.output.empty()) {
+        std::ofstream f{opts.output};
+        f << ToJson(opts, results).dump(4) << '\n';
+        if (not f) {
+            std::println(stderr, "Could not write results to '{}'", opts.output);
+            return 1;
+        }
+    }
+
+    if (not opts.baseline.empty() and not CompareToBaseline(opts, results)) return 1;
+    return 0;
+}
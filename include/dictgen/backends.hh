@@ -1,16 +1,32 @@
 #ifndef BACKENDS_HH
 #define BACKENDS_HH
 
-#include <base/Trie.hh>
+#include <dictgen/cache.hh>
 #include <dictgen/parser.hh>
+#include <dictgen/profile.hh>
+#include <dictgen/transliterator.hh>
 #include <nlohmann/json.hpp>
+#include <map>
 
 namespace dict {
 using nlohmann::json;
 
 class Backend;
+class BinaryBackend;
 class JsonBackend;
 
+/// Backends that a section of the input is for, as set by '$backend'.
+enum class BackendTag : u8 {
+    All,
+
+    /// The JSON and binary backends; the latter contains the same HTML.
+    Json,
+    TeX,
+};
+
+/// IPA transcriptions that were computed ahead of time.
+using IpaTable = std::unordered_map<std::string, Result<std::string>>;
+
 class Backend {
 protected:
     Backend(LanguageOps& ops) : ops{ops} {}
@@ -22,6 +38,9 @@ public:
     /// Output buffer.
     std::string output;
 
+    /// Arena used for TeX ASTs; this is reset after each field.
+    Arena arena;
+
     /// Current line.
     i64 line = 1;
 
@@ -31,6 +50,15 @@ public:
     /// Temporarily suppresses any output.
     bool suppress_output = false;
 
+    /// Profiler to record timings in, if any.
+    Profiler* profiler = nullptr;
+
+    /// Cache for IPA transcriptions, if any.
+    IpaCache* ipa_cache = nullptr;
+
+    /// Transcriptions that were computed before emission, if any.
+    const IpaTable* precomputed_ipa = nullptr;
+
     /// Create a new backend.
     template <std::derived_from<Backend> BackendType, typename... Args>
     static auto New(Args&&... args) -> std::unique_ptr<Backend> {
@@ -44,10 +72,29 @@ public:
         emit_error(std::format("In Line {}: {}", line, std::format(fmt, LIBBASE_FWD(args)...)));
     }
 
+    /// Convert a word to IPA, using the precomputed transcriptions or
+    /// the cache if we have them.
+    [[nodiscard]] auto to_ipa(str word) -> Result<std::string> {
+        if (precomputed_ipa) {
+            auto it = precomputed_ipa->find(word.string());
+            if (it != precomputed_ipa->end()) return it->second;
+        }
+
+        ProfileScope _{profiler, Phase::ToIPA};
+        if (ipa_cache) {
+            if (auto cached = ipa_cache->find(word)) return std::move(*cached);
+        }
+
+        // Don’t cache errors so they’re reported again next time.
+        auto ipa = ops.to_ipa(word);
+        if (ipa_cache and ipa.has_value()) ipa_cache->insert(word, ipa.value());
+        return ipa;
+    }
+
     /// Print to the output.
     template <typename... Args>
     void print(std::format_string<Args...> fmt, Args&&... args) {
-        output += std::format(fmt, LIBBASE_FWD(args)...);
+        std::format_to(std::back_inserter(output), fmt, LIBBASE_FWD(args)...);
     }
 
     /// Destructor.
@@ -60,38 +107,297 @@ public:
     virtual void emit(str word, const FullEntry& data) = 0;
     virtual void emit_error(std::string error) = 0;
     virtual void finish() {}
+
+    /// Get the string this backend will pass to to_ipa() when it emits
+    /// an entry, if any; the generator uses this to convert the words
+    /// for all entries in one batch before emission.
+    [[nodiscard]] virtual auto ipa_source(str /*word*/, const FullEntry& /*data*/) -> std::optional<std::string> {
+        return std::nullopt;
+    }
+
+    /// Create a backend that emits into its own buffers.
+    ///
+    /// This is used to emit entries on multiple threads: each thread
+    /// emits a contiguous range of entries into a fork, and the forks
+    /// are then merged back in order using join(). Backends that don’t
+    /// support this return nullptr.
+    virtual auto fork() -> std::unique_ptr<Backend> { return nullptr; }
+
+    /// Append everything that was emitted into a backend created by fork().
+    ///
+    /// This leaves the fork empty so it can be reused.
+    virtual void join(Backend&) { Unreachable("Backend does not support fork()"); }
+
+    /// Get a string that identifies this backend and its options; output
+    /// emitted by backends with different tags is never shared. Backends
+    /// whose output should not be cached return the empty string.
+    [[nodiscard]] virtual auto cache_tag() const -> std::string { return ""; }
+
+    /// Whether the output of an entry is final once it has been emitted
+    /// or joined; if so, the generator may take everything in 'output'
+    /// and pass it to an output sink between entries. Backends that still
+    /// need to edit or rearrange their output in finish() return false.
+    [[nodiscard]] virtual auto streams_output() const -> bool { return false; }
+
+    /// Whether entries in a '$backend' section with this tag are emitted
+    /// into this backend.
+    [[nodiscard]] virtual auto accepts(BackendTag tag) const -> bool { return tag == BackendTag::All; }
+
+    /// Take everything that was emitted into a fork as a fragment that
+    /// can later be passed to splice(); this leaves the fork empty. This
+    /// returns nothing if there were any errors, since we don’t want to
+    /// hang on to output that we know is broken.
+    [[nodiscard]] virtual auto take_fragment() -> std::optional<std::string> {
+        Unreachable("Backend does not support fork()");
+    }
+
+    /// Append a fragment returned by take_fragment().
+    virtual void splice(str) { Unreachable("Backend does not support fork()"); }
+};
+
+/// Streaming JSON writer.
+///
+/// This produces the same formatting as 'json::dump()', so we don’t
+/// have to build a DOM just to print it. Keys are written in the order
+/// they are passed in, so callers must sort them themselves.
+class JsonWriter {
+    std::string& out;
+    std::vector<bool> open_containers;
+    bool minify;
+    bool first = true;
+    i32 depth;
+
+public:
+    /// Create a writer that appends to 'out'; 'depth' is the indentation
+    /// level of the first value we write.
+    JsonWriter(std::string& out, bool minify, i32 depth)
+        : out{out}, minify{minify}, depth{depth} {}
+
+    auto begin_array() -> JsonWriter&;
+    auto begin_object() -> JsonWriter&;
+    auto end_array() -> JsonWriter&;
+    auto end_object() -> JsonWriter&;
+
+    /// Start an array element.
+    auto element() -> JsonWriter&;
+
+    /// Write an object key; this must be followed by a value.
+    auto key(str k) -> JsonWriter&;
+
+    /// Write a line break and indentation, unless we’re minifying.
+    void newline();
+
+    /// Write a number.
+    auto number(u64 n) -> JsonWriter&;
+
+    /// Write a string value.
+    auto string(str s) -> JsonWriter&;
+
+private:
+    void Close(char c);
+    void Open(char c);
+    void Separate();
 };
 
 class JsonBackend final : public Backend {
-    struct Renderer;
-    trie html_escaper;
-    json out;
+public:
+    /// Inverted index that maps each search token to the indices of the
+    /// entries or references whose search strings contain it.
+    struct SearchIndex {
+        using Postings = std::map<std::string, std::vector<u32>, std::less<>>;
+        Postings def;  ///< Tokens in 'def-search'; indices into 'entries'.
+        Postings from; ///< Tokens in 'from-search'; indices into 'refs'.
+        Postings hw;   ///< Tokens in 'hw-search'; indices into 'entries'.
+    };
+
+    /// How to split the output into shards.
+    enum class Sharding : u8 {
+        None,      ///< Emit a single document.
+        ByInitial, ///< Start a new shard whenever the initial letter of the headword changes.
+        BySize,    ///< Put a fixed number of entries and references in each shard.
+    };
+
+    /// A file in the sharded output.
+    struct Shard {
+        std::string name;
+        std::string contents;
+    };
+
+private:
+    friend BinaryBackend;
+    template <bool StripFormatting> struct Renderer;
+
+    /// An entry or reference, converted to HTML.
+    struct HtmlExample {
+        std::string text;
+        std::optional<std::string> comment;
+    };
+
+    struct HtmlSense {
+        std::string def;
+        std::optional<std::string> comment;
+        std::vector<HtmlExample> examples;
+    };
+
+    struct HtmlEntry {
+        std::string word;
+        std::string stripped_word;
+        std::string pos;
+        std::string ipa;
+        std::string hw_search;
+        std::string def_search;
+        std::optional<std::string> etym;
+        std::optional<std::string> forms;
+        std::optional<HtmlSense> def;
+        std::vector<HtmlSense> senses;
+    };
+
+    struct HtmlRef {
+        std::string from;
+        std::string stripped_from;
+        std::string from_search;
+        std::string to;
+    };
+
     std::string errors;
     std::string current_word;
     bool minify;
 
-    /// A transliterator used to normalise headwords for searching.
-    text::Transliterator search_transliterator{"NFKD; Latin-ASCII; [^a-z A-Z\\ ] Remove; Lower"};
+    /// References; these are written after the entries.
+    std::string refs_output;
+
+    /// Number of entries and references written so far.
+    usz entry_count = 0;
+    usz ref_count = 0;
+
+    /// Rules used to normalise headwords for searching.
+    static constexpr str SearchRules = "NFKD; Latin-ASCII; [^a-z A-Z\\ ] Remove; Lower";
+
+    /// A transliterator used to normalise headwords for searching; this
+    /// is acquired the first time we need it.
+    std::optional<TransliteratorRegistry::Lease> search_transliterator;
+
+    /// Scratch buffers for normalising ASCII text for searching.
+    std::string search_buffer;
+    std::vector<std::string_view> search_words;
+
+    /// The search index, if we’re building one.
+    std::unique_ptr<SearchIndex> search_index;
+
+    /// An entry or reference in sharded mode; these are recorded in the
+    /// order they were emitted, which is the order they were sorted in.
+    struct ShardElement {
+        std::string initial; ///< Initial letter of the headword, if sharding by initial.
+        std::string word;    ///< Headword, as it appears in the output.
+        usz begin;           ///< Start of this element in the output buffer.
+        usz end;             ///< End of this element in the output buffer.
+        bool ref;            ///< Whether this is a reference.
+    };
+
+    Sharding sharding = Sharding::None;
+    usz shard_size = 0;
+    std::vector<ShardElement> shard_elements;
+    std::vector<Shard> shard_files;
 
 public:
-    explicit JsonBackend(LanguageOps& ops, bool minify);
+    /// Create a JSON backend.
+    ///
+    /// If 'search_index' is true, the output also contains an 'index' object
+    /// with the keys 'def', 'from', and 'hw'; each of these maps a search
+    /// token to a sorted list of the indices of the entries (or references,
+    /// for 'from') whose 'def-search', 'from-search', or 'hw-search' string
+    /// contains that token. To keep the index small, each list is delta-encoded:
+    /// the first element is an index, and every subsequent element is the
+    /// difference to the previous one.
+    explicit JsonBackend(LanguageOps& ops, bool minify, bool search_index = false);
+
+    /// Split the output into shards so it can be loaded lazily.
+    ///
+    /// In sharded mode, the shards follow the order the entries are emitted
+    /// in, i.e. collation order. Each shard is a document in the same format
+    /// as the unsharded output (but without a search index). The output of
+    /// the backend is then a manifest instead: an object whose 'shards' key
+    /// is an array that describes each shard in order using the keys 'file'
+    /// (the name of the shard), 'entries' and 'refs' (the number of entries
+    /// and references in it), 'first' and 'last' (its first and last headword),
+    /// and, when sharding by initial, 'initial'. The search index, if enabled,
+    /// is written to the manifest; its indices count entries and references
+    /// across all shards, in order.
+    void shard_by_initial();
+    void shard_by_size(usz elements);
+
+    /// Get the shards; this is empty unless sharding is enabled and
+    /// finish() has been called.
+    [[nodiscard]] auto shards() const -> const std::vector<Shard>& { return shard_files; }
+
+    /// Write the manifest (as 'manifest.json') and the shards to a directory.
+    [[nodiscard]] auto write_shards(const std::filesystem::path& dir) const -> Result<>;
 
     void emit(str word, const FullEntry& data) override;
     void emit(str word, const RefEntry& data) override;
     void emit_error(std::string error) override;
     void finish() override;
+    auto fork() -> std::unique_ptr<Backend> override;
+    void join(Backend& fork) override;
+    auto cache_tag() const -> std::string override;
+    auto take_fragment() -> std::optional<std::string> override;
+    void splice(str fragment) override;
+    auto ipa_source(str word, const FullEntry& data) -> std::optional<std::string> override;
+    auto accepts(BackendTag tag) const -> bool override { return tag != BackendTag::TeX; }
 
 private:
+    JsonBackend(LanguageOps& ops, bool minify, bool search_index, bool write_header);
     auto NormaliseForSearch(str value) -> std::string;
+    auto NormaliseAsciiForSearch(str value) -> std::string;
+    auto NormaliseForSearchGeneric(str value) -> std::string;
+    static auto PostprocessSearchHaystack(str haystack) -> std::string;
+    static void EscapeHtml(std::string& out, str text);
+    auto ConvertEntry(str word, const FullEntry& data) -> HtmlEntry;
+    auto ConvertRef(str word, const RefEntry& data) -> HtmlRef;
+    auto Initial(str stripped_word) -> std::string;
+    void OpenDocument(std::string& out);
+    void CloseDocument(std::string& out, usz entries, str refs, usz refs_count, bool index);
+    void FinishSharded();
+    void WriteIndex(JsonWriter& w);
+    auto begin_element(std::string& buffer, usz& count) -> JsonWriter;
     auto tex_to_html(str input, bool strip_macros = false) -> std::string;
-    auto entries() -> json& { return out["entries"]; }
-    auto refs() -> json& { return out["refs"]; }
-    auto tag_name(Macro m) -> str;
+
+    /// Render a field both as HTML and as text without formatting.
+    auto tex_to_html_and_text(str input) -> std::pair<std::string, std::string>;
+};
+
+/// Backend that writes a compact binary dictionary that can be memory-mapped
+/// and searched without parsing it; see 'binary.hh' for the format and a
+/// reader. Fields are rendered to the same HTML as in the JsonBackend.
+class BinaryBackend final : public Backend {
+    /// Used to convert fields to HTML.
+    JsonBackend html;
+    std::string errors;
+
+    /// Everything we’ve emitted so far; the file is laid out in finish().
+    std::vector<JsonBackend::HtmlEntry> entries;
+    std::vector<JsonBackend::HtmlRef> refs;
+
+public:
+    explicit BinaryBackend(LanguageOps& ops);
+
+    void emit(str word, const FullEntry& data) override;
+    void emit(str word, const RefEntry& data) override;
+    void emit_error(std::string error) override;
+    void finish() override;
+    auto fork() -> std::unique_ptr<Backend> override;
+    void join(Backend& fork) override;
+    auto ipa_source(str word, const FullEntry& data) -> std::optional<std::string> override;
+    auto accepts(BackendTag tag) const -> bool override { return tag != BackendTag::TeX; }
+
+private:
+    void BeginConversion();
+    void EndConversion();
 };
 
 class TypstBackend final : public Backend {
     friend TexParser;
-    struct Renderer;
+    template <bool StripFormatting> struct Renderer;
     std::string current_word;
     std::string errors;
 
@@ -102,9 +408,20 @@ public:
     void emit(str word, const RefEntry& data) override;
     void emit_error(std::string error) override;
     void finish() override;
+    auto fork() -> std::unique_ptr<Backend> override;
+    void join(Backend& fork) override;
+    auto cache_tag() const -> std::string override;
+    auto take_fragment() -> std::optional<std::string> override;
+    void splice(str fragment) override;
+    auto ipa_source(str word, const FullEntry& data) -> std::optional<std::string> override;
+    auto streams_output() const -> bool override { return true; }
 
 private:
+    static void EscapeMarkup(std::string& out, str text);
     auto convert(str input, bool strip_macros = false) -> std::string;
+
+    /// Convert a field both with and without formatting.
+    auto convert_and_strip(str input) -> std::pair<std::string, std::string>;
 };
 
 class TeXBackend final : public Backend {
@@ -120,6 +437,8 @@ public:
     //  if we print it when the program runs, it’s likely to get missed,
     //  so we do this instead.
     void emit_error(std::string error) override;
+    auto streams_output() const -> bool override { return true; }
+    auto accepts(BackendTag tag) const -> bool override { return tag != BackendTag::Json; }
 };
 } // namespace dict
 
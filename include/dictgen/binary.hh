@@ -0,0 +1,259 @@
+#ifndef DICTIONARY_GENERATOR_BINARY_HH
+#define DICTIONARY_GENERATOR_BINARY_HH
+
+#include <base/Base.hh>
+#include <dictgen/file.hh>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include <variant>
+
+/// Layout of the files written by the BinaryBackend.
+///
+/// A file starts with a Header, which contains the offsets (from the start
+/// of the file) and sizes of each of the tables below; every table is an
+/// array of fixed-size records, all of which consist of 32-bit integers in
+/// little-endian order. Strings are stored in a string table and referred
+/// to by offset and size; they are not NUL-terminated.
+///
+///   - Entries, in collation order.
+///   - Senses: each entry refers to its primary definition and a contiguous
+///     range of additional senses in this table.
+///   - Examples: each sense refers to a contiguous range of examples.
+///   - References, in collation order.
+///   - The headword index: every entry and reference, sorted bytewise by
+///     the headword with all formatting stripped; this is what lookups
+///     binary-search.
+///   - The string table.
+///
+/// All text fields contain the same HTML as the corresponding fields in
+/// the output of the JsonBackend.
+namespace dict::binary {
+using namespace base;
+
+/// Bump this whenever the layout changes.
+constexpr u32 Version = 1;
+constexpr std::array<char, 4> Magic{'D', 'G', 'B', 'D'};
+
+/// Index of a sense that doesn’t exist.
+constexpr u32 NoSense = ~u32(0);
+
+/// A string in the string table.
+struct StringRef {
+    /// Offset used for optional strings that are absent.
+    static constexpr u32 Absent = ~u32(0);
+
+    u32 offset = Absent;
+    u32 size = 0;
+};
+
+struct Header {
+    std::array<char, 4> magic;
+    u32 version;
+    u32 entry_count;
+    u32 sense_count;
+    u32 example_count;
+    u32 ref_count;
+    u32 index_count;
+    u32 entries;
+    u32 senses;
+    u32 examples;
+    u32 refs;
+    u32 index;
+    u32 strings;
+    u32 strings_size;
+};
+
+struct Entry {
+    StringRef word;
+    StringRef pos;
+    StringRef ipa;
+    StringRef etym;
+    StringRef forms;
+    StringRef hw_search;
+    StringRef def_search;
+    u32 def; ///< Primary definition, or 'NoSense'.
+    u32 first_sense;
+    u32 sense_count;
+};
+
+struct Sense {
+    StringRef def;
+    StringRef comment;
+    u32 first_example;
+    u32 example_count;
+};
+
+struct Example {
+    StringRef text;
+    StringRef comment;
+};
+
+struct Ref {
+    StringRef from;
+    StringRef from_search;
+    StringRef to;
+};
+
+struct IndexRecord {
+    StringRef key;
+    u32 element; ///< Index into the entries or references.
+    u32 is_ref;
+};
+
+static_assert(std::is_trivially_copyable_v<Header> and sizeof(Header) == 14 * sizeof(u32));
+static_assert(std::is_trivially_copyable_v<Entry> and sizeof(Entry) % sizeof(u32) == 0);
+static_assert(std::is_trivially_copyable_v<Sense> and sizeof(Sense) % sizeof(u32) == 0);
+static_assert(std::is_trivially_copyable_v<Example> and sizeof(Example) % sizeof(u32) == 0);
+static_assert(std::is_trivially_copyable_v<Ref> and sizeof(Ref) % sizeof(u32) == 0);
+static_assert(std::is_trivially_copyable_v<IndexRecord> and sizeof(IndexRecord) % sizeof(u32) == 0);
+
+/// Convert a record between host and file byte order; this does nothing
+/// on little-endian hosts. Every field is a 32-bit integer, except for the
+/// magic number, which is a sequence of bytes and is left alone.
+template <typename T>
+[[nodiscard]] auto ByteOrder(T rec) -> T {
+    if constexpr (std::endian::native == std::endian::big) {
+        std::array<u32, sizeof(T) / sizeof(u32)> words;
+        std::memcpy(words.data(), &rec, sizeof(T));
+        for (auto& w : words) w = std::byteswap(w);
+        if constexpr (std::is_same_v<T, Header>) std::memcpy(words.data(), &rec.magic, sizeof(rec.magic));
+        std::memcpy(&rec, words.data(), sizeof(T));
+    }
+
+    return rec;
+}
+} // namespace dict::binary
+
+namespace dict {
+/// Reader for files written by the BinaryBackend.
+///
+/// Nothing is copied or parsed when a dictionary is opened apart from the
+/// header, and only the header and the bounds of each table are checked.
+/// Records are read from the underlying buffer on demand, and any strings
+/// or records they refer to are checked when they are accessed, which is
+/// why the accessors return a Result. All strings returned by this point
+/// into the buffer.
+class BinaryDictionary {
+    std::unique_ptr<MappedFile> file;
+    str data;
+    binary::Header header{};
+
+    BinaryDictionary() = default;
+
+    /// Check that records [first, first + count) of a table with 'total'
+    /// records exist, and map 'get' over their indices if so.
+    template <typename Get>
+    [[nodiscard]] auto range(u32 first, u32 count, u32 total, Get get) const {
+        using View = decltype(vws::iota(first, first) | vws::transform(get));
+        if (u64(first) + count > total) return Result<View>{
+            Error("Corrupt binary dictionary: records {}..{} are out of bounds", first, u64(first) + count)
+        };
+        return Result<View>{vws::iota(first, first + count) | vws::transform(get)};
+    }
+
+public:
+    class Example {
+        friend BinaryDictionary;
+        const BinaryDictionary* dict;
+        binary::Example rec;
+        Example(const BinaryDictionary* dict, binary::Example rec) : dict{dict}, rec{rec} {}
+
+    public:
+        [[nodiscard]] auto text() const -> Result<str> { return dict->required(rec.text); }
+        [[nodiscard]] auto comment() const -> Result<std::optional<str>> { return dict->string(rec.comment); }
+    };
+
+    class Sense {
+        friend BinaryDictionary;
+        const BinaryDictionary* dict;
+        binary::Sense rec;
+        Sense(const BinaryDictionary* dict, binary::Sense rec) : dict{dict}, rec{rec} {}
+
+    public:
+        [[nodiscard]] auto def() const -> Result<str> { return dict->required(rec.def); }
+        [[nodiscard]] auto comment() const -> Result<std::optional<str>> { return dict->string(rec.comment); }
+        [[nodiscard]] auto examples() const {
+            return dict->range(rec.first_example, rec.example_count, dict->header.example_count, [d = dict](u32 i) {
+                return d->example(i);
+            });
+        }
+    };
+
+    class Entry {
+        friend BinaryDictionary;
+        const BinaryDictionary* dict;
+        binary::Entry rec;
+        Entry(const BinaryDictionary* dict, binary::Entry rec) : dict{dict}, rec{rec} {}
+
+    public:
+        [[nodiscard]] auto word() const -> Result<str> { return dict->required(rec.word); }
+        [[nodiscard]] auto pos() const -> Result<str> { return dict->required(rec.pos); }
+        [[nodiscard]] auto ipa() const -> Result<str> { return dict->required(rec.ipa); }
+        [[nodiscard]] auto etym() const -> Result<std::optional<str>> { return dict->string(rec.etym); }
+        [[nodiscard]] auto forms() const -> Result<std::optional<str>> { return dict->string(rec.forms); }
+        [[nodiscard]] auto hw_search() const -> Result<str> { return dict->required(rec.hw_search); }
+        [[nodiscard]] auto def_search() const -> Result<str> { return dict->required(rec.def_search); }
+        [[nodiscard]] auto def() const -> Result<std::optional<Sense>> {
+            if (rec.def == binary::NoSense) return std::nullopt;
+            if (rec.def >= dict->header.sense_count) return Error("Corrupt binary dictionary: sense {} is out of bounds", rec.def);
+            return dict->sense(rec.def);
+        }
+
+        [[nodiscard]] auto senses() const {
+            return dict->range(rec.first_sense, rec.sense_count, dict->header.sense_count, [d = dict](u32 i) {
+                return d->sense(i);
+            });
+        }
+    };
+
+    class Ref {
+        friend BinaryDictionary;
+        const BinaryDictionary* dict;
+        binary::Ref rec;
+        Ref(const BinaryDictionary* dict, binary::Ref rec) : dict{dict}, rec{rec} {}
+
+    public:
+        [[nodiscard]] auto from() const -> Result<str> { return dict->required(rec.from); }
+        [[nodiscard]] auto from_search() const -> Result<str> { return dict->required(rec.from_search); }
+        [[nodiscard]] auto to() const -> Result<str> { return dict->required(rec.to); }
+    };
+
+    using Element = std::variant<Entry, Ref>;
+
+    /// Open a dictionary file.
+    [[nodiscard]] static auto Open(const std::filesystem::path& path) -> Result<BinaryDictionary>;
+
+    /// Read a dictionary from memory; the data must outlive the dictionary.
+    [[nodiscard]] static auto Load(str data) -> Result<BinaryDictionary>;
+
+    /// Get the number of entries and references.
+    [[nodiscard]] auto entry_count() const -> usz { return header.entry_count; }
+    [[nodiscard]] auto ref_count() const -> usz { return header.ref_count; }
+
+    /// Get an entry or reference by index.
+    [[nodiscard]] auto entry(usz i) const -> Entry;
+    [[nodiscard]] auto ref(usz i) const -> Ref;
+
+    /// Get every entry and reference whose headword, with all formatting
+    /// stripped, is exactly 'word', in collation order (entries first).
+    [[nodiscard]] auto lookup(str word) const -> Result<std::vector<Element>>;
+
+private:
+    template <typename T>
+    [[nodiscard]] auto Record(u32 table, u32 count, usz i) const -> T {
+        Assert(i < count, "Index {} out of bounds", i);
+        T t;
+        std::memcpy(&t, data.data() + table + i * sizeof(T), sizeof(T));
+        return binary::ByteOrder(t);
+    }
+
+    [[nodiscard]] auto example(usz i) const -> Example;
+    [[nodiscard]] auto required(binary::StringRef s) const -> Result<str>;
+    [[nodiscard]] auto sense(usz i) const -> Sense;
+    [[nodiscard]] auto string(binary::StringRef s) const -> Result<std::optional<str>>;
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_BINARY_HH
@@ -0,0 +1,105 @@
+#ifndef DICTIONARY_GENERATOR_CACHE_HH
+#define DICTIONARY_GENERATOR_CACHE_HH
+
+#include <base/Base.hh>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dict {
+using namespace base;
+
+/// Hash a sequence of bytes (FNV-1a).
+///
+/// Unlike 'std::hash', this is stable across runs, which is what
+/// we need for anything that ends up on disk.
+[[nodiscard]] constexpr auto HashBytes(std::string_view data, u64 hash = 0xcbf2'9ce4'8422'2325) -> u64 {
+    for (char c : data) {
+        hash ^= u8(c);
+        hash *= 0x100'0000'01b3;
+    }
+    return hash;
+}
+
+/// On-disk cache for the output of individual entries.
+///
+/// Entries are keyed by a hash of the line they were parsed from, the
+/// headword, the backend and its options, and the language’s version
+/// tag, so an entry only needs to be emitted again if any of those
+/// change. Fragments that were not used during a run are dropped when
+/// the cache is saved.
+///
+/// This is not thread-safe; the generator only accesses it from a
+/// single thread.
+class OutputCache {
+    std::unordered_map<u64, std::string> fragments;
+    std::unordered_set<u64> used;
+
+public:
+    OutputCache() = default;
+
+    /// Load a cache from disk. If the file does not exist or is not
+    /// a valid cache file, this returns an empty cache.
+    [[nodiscard]] static auto Load(const std::filesystem::path& path) -> OutputCache;
+
+    /// Look up a fragment.
+    [[nodiscard]] auto find(u64 key) -> const std::string*;
+
+    /// Add a fragment.
+    void insert(u64 key, std::string fragment);
+
+    /// Write the cache to disk.
+    [[nodiscard]] auto save(const std::filesystem::path& path) const -> Result<>;
+
+    /// Get the number of fragments in the cache.
+    [[nodiscard]] auto size() const -> usz { return fragments.size(); }
+};
+
+/// On-disk cache for the output of 'LanguageOps::to_ipa()'.
+///
+/// The cache is tied to the language’s version tag: if the tag in the
+/// file doesn’t match the one it is loaded with, the cache starts out
+/// empty. Like the output cache, transcriptions that were not used
+/// during a run are dropped when the cache is saved.
+///
+/// Unlike the output cache, this is thread-safe, since backends look
+/// up transcriptions while emitting entries on worker threads.
+class IpaCache {
+    mutable std::mutex mutex;
+    std::string version;
+    std::unordered_map<std::string, std::string> transcriptions;
+    std::unordered_set<std::string> used;
+
+    explicit IpaCache(
+        std::string version,
+        std::unordered_map<std::string, std::string> transcriptions = {}
+    ) : version{std::move(version)}, transcriptions{std::move(transcriptions)} {}
+
+public:
+    /// Create an empty cache.
+    [[nodiscard]] static auto Empty(std::string version_tag) -> IpaCache { return IpaCache{std::move(version_tag)}; }
+
+    /// Load a cache from disk. If the file does not exist, is not a
+    /// valid cache file, or was created for a different version tag,
+    /// this returns an empty cache.
+    [[nodiscard]] static auto Load(const std::filesystem::path& path, std::string version_tag) -> IpaCache;
+
+    /// Look up the transcription of a word.
+    [[nodiscard]] auto find(str word) -> std::optional<std::string>;
+
+    /// Add a transcription.
+    void insert(str word, std::string ipa);
+
+    /// Write the cache to disk.
+    [[nodiscard]] auto save(const std::filesystem::path& path) const -> Result<>;
+
+    /// Get the number of transcriptions in the cache.
+    [[nodiscard]] auto size() const -> usz;
+
+    /// Get the version tag this cache was created for.
+    [[nodiscard]] auto version_tag() const -> str { return version; }
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_CACHE_HH
@@ -3,12 +3,16 @@
 
 #include <base/Base.hh>
 #include <base/Text.hh>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <unordered_map>
 
 namespace dict {
 using namespace base;
 class TexParser;
 class Backend;
-class Renderer;
 
 using RefEntry = std::string;
 struct FullEntry {
@@ -61,42 +65,148 @@ struct FullEntry {
     std::string forms;
 };
 
+/// Bump allocator for short-lived data, such as TeX ASTs.
+///
+/// Memory is only ever released when the arena is destroyed; reset()
+/// merely rewinds it so the chunks can be reused. Destructors of objects
+/// allocated in an arena are never run, so only trivially destructible
+/// data should be stored in it.
+class Arena {
+    LIBBASE_IMMOVABLE(Arena);
+    static constexpr usz MinChunkSize = 16 * 1024;
+
+    struct Chunk {
+        std::unique_ptr<std::byte[]> data;
+        usz size;
+    };
+
+    std::vector<Chunk> chunks;
+    usz next_chunk = 0;
+    std::byte* ptr = nullptr;
+    std::byte* end = nullptr;
+
+public:
+    Arena() = default;
+
+    /// Allocate uninitialised memory.
+    [[nodiscard]] auto allocate(usz size, usz align) -> void* {
+        for (;;) {
+            auto p = reinterpret_cast<std::uintptr_t>(ptr);
+            auto aligned = (p + align - 1) & ~std::uintptr_t(align - 1);
+            if (ptr and aligned + size <= reinterpret_cast<std::uintptr_t>(end)) {
+                ptr = reinterpret_cast<std::byte*>(aligned + size);
+                return reinterpret_cast<void*>(aligned);
+            }
+
+            NextChunk(size + align);
+        }
+    }
+
+    /// Get the number of chunks this arena has allocated.
+    [[nodiscard]] auto chunk_count() const -> usz { return chunks.size(); }
+
+    /// Copy a list of objects into the arena.
+    template <typename T>
+    requires std::is_trivially_copyable_v<T>
+    [[nodiscard]] auto copy(std::span<const T> data) -> std::span<const T> {
+        if (data.empty()) return {};
+        auto mem = static_cast<T*>(allocate(data.size_bytes(), alignof(T)));
+        std::memcpy(mem, data.data(), data.size_bytes());
+        return {mem, data.size()};
+    }
+
+    /// Copy a string into the arena.
+    [[nodiscard]] auto copy(str s) -> str {
+        auto chars = copy(std::span<const char>{s.data(), s.size()});
+        return str{std::string_view{chars.data(), chars.size()}};
+    }
+
+    /// Create an object in the arena.
+    template <typename T, typename... Args>
+    [[nodiscard]] auto make(Args&&... args) -> T* {
+        return ::new (allocate(sizeof(T), alignof(T))) T(LIBBASE_FWD(args)...);
+    }
+
+    /// Discard everything allocated in the arena, but keep the memory around.
+    void reset() {
+        next_chunk = 0;
+        ptr = end = nullptr;
+    }
+
+private:
+    void NextChunk(usz min_size) {
+        while (next_chunk < chunks.size() and chunks[next_chunk].size < min_size) next_chunk++;
+        if (next_chunk == chunks.size()) {
+            auto size = std::max(MinChunkSize, min_size);
+            chunks.emplace_back(std::make_unique_for_overwrite<std::byte[]>(size), size);
+        }
+
+        auto& c = chunks[next_chunk++];
+        ptr = c.data.get();
+        end = ptr + c.size;
+    }
+};
+
+/// A node in the TeX AST.
+///
+/// Nodes are allocated in an 'Arena' and never destroyed, so they must
+/// not own any memory; strings and child lists live in the arena too.
 struct [[nodiscard]] Node {
     LIBBASE_IMMOVABLE(Node);
-    struct Ptr : std::unique_ptr<Node> {
+
+    /// Non-owning pointer to a node.
+    class Ptr {
+        Node* ptr;
+
+    public:
         Ptr() = delete("Should never construct a 'null' node");
-        explicit Ptr(std::unique_ptr<Node> base) : unique_ptr(std::move(base)) {}
+        explicit Ptr(Node* ptr) : ptr(ptr) {}
+
+        [[nodiscard]] auto get() const -> Node* { return ptr; }
+        [[nodiscard]] auto operator*() const -> Node& { return *ptr; }
+        [[nodiscard]] auto operator->() const -> Node* { return ptr; }
+    };
+
+    /// The kind of a node; used instead of RTTI to dispatch on node types.
+    enum struct Kind : u8 {
+        Text,
+        ComputedText,
+        Formatting,
+        Macro,
+        Content,
+        Empty,
     };
 
-    virtual ~Node() = default;
+    const Kind kind;
 
     template <std::derived_from<Node> NodeTy>
     [[nodiscard]] auto as() const -> const NodeTy* {
-        return dynamic_cast<const NodeTy*>(this);
+        return kind == NodeTy::StaticKind ? static_cast<const NodeTy*>(this) : nullptr;
     }
 
     template <std::derived_from<Node> NodeTy>
-    [[nodiscard]] bool is() const { return as<NodeTy>() != nullptr; }
+    [[nodiscard]] bool is() const { return kind == NodeTy::StaticKind; }
 
 protected:
-    Node() = default;
+    explicit Node(Kind kind) : kind(kind) {}
 };
 
 struct TextNode final : Node {
+    static constexpr Kind StaticKind = Kind::Text;
     str text;
-    explicit TextNode(str text) : text(text) {}
+    explicit TextNode(str text) : Node(StaticKind), text(text) {}
 };
 
 struct ComputedTextNode final : Node {
-    std::string text;
-    explicit ComputedTextNode(std::string text)
-        : text(std::move(text)) {}
+    static constexpr Kind StaticKind = Kind::ComputedText;
+    str text;
+    explicit ComputedTextNode(str text) : Node(StaticKind), text(text) {}
 };
 
 struct FormattingNode final : Node {
-    std::string text;
-    explicit FormattingNode(std::string text)
-        : text(std::move(text)) {}
+    static constexpr Kind StaticKind = Kind::Formatting;
+    str text;
+    explicit FormattingNode(str text) : Node(StaticKind), text(text) {}
 };
 
 /// Builtin macros.
@@ -116,38 +226,192 @@ enum class Macro {
 };
 
 struct MacroNode final : Node {
+    static constexpr Kind StaticKind = Kind::Macro;
     const Macro macro;
-    FixedVector<Ptr, 1> args;
-
-    explicit MacroNode(Macro macro, FixedVector<Ptr, 1> args = {})
-        : macro(macro),
-          args(std::move(args)) {}
+    std::span<const Ptr> args;
 
-    explicit MacroNode(Macro macro, Ptr arg) : macro(macro), args{std::move(arg)} {}
+    explicit MacroNode(Macro macro, std::span<const Ptr> args = {})
+        : Node(StaticKind),
+          macro(macro),
+          args(args) {}
 };
 
 struct ContentNode final : Node {
-    std::vector<Ptr> children;
-    explicit ContentNode(std::vector<Ptr> children) : children(std::move(children)) {}
+    static constexpr Kind StaticKind = Kind::Content;
+    std::span<const Ptr> children;
+    explicit ContentNode(std::span<const Ptr> children) : Node(StaticKind), children(children) {}
 };
 
-struct EmptyNode final : Node {};
+struct EmptyNode final : Node {
+    static constexpr Kind StaticKind = Kind::Empty;
+    EmptyNode() : Node(StaticKind) {}
+};
 
-class Renderer {
+/// Receives the output of the parser when a field is rendered without
+/// building a tree; see 'TexParser::Render()'.
+class RenderSink {
+public:
+    virtual ~RenderSink() = default;
+
+    /// Render text, which needs to be escaped.
+    virtual void render_text(str text) = 0;
+
+    /// Render formatting, which is inserted literally.
+    virtual void render_formatting(str formatting) = 0;
+
+    /// Start a builtin macro. If this returns true, its arguments are
+    /// rendered next, followed by a call to 'end_macro()'; otherwise,
+    /// they are skipped.
+    virtual bool begin_macro(Macro m) = 0;
+    virtual void end_macro(Macro m) = 0;
+
+    /// Render a tree returned by a macro handler.
+    virtual void render(const Node& n) = 0;
+};
+
+/// Base class for renderers.
+///
+/// Renderers derive from this using CRTP and provide 'begin_macro()',
+/// 'end_macro()', and 'render_text()'; they may also provide their own
+/// 'render_formatting()'. Derived classes should be final so calls to
+/// these are not dispatched dynamically when we render a tree.
+template <typename Derived>
+class Renderer : public RenderSink {
 public:
     std::string out;
 
-    virtual ~Renderer() = default;
+    void render(const Node& n) override {
+        switch (n.kind) {
+            case Node::Kind::Empty: return;
+            case Node::Kind::Text: return self().render_text(static_cast<const TextNode&>(n).text);
+            case Node::Kind::ComputedText: return self().render_text(static_cast<const ComputedTextNode&>(n).text);
+            case Node::Kind::Formatting: return self().render_formatting(static_cast<const FormattingNode&>(n).text);
+            case Node::Kind::Content: return render(static_cast<const ContentNode&>(n).children);
+            case Node::Kind::Macro: {
+                auto& m = static_cast<const MacroNode&>(n);
+                if (self().begin_macro(m.macro)) {
+                    render(m.args);
+                    self().end_macro(m.macro);
+                }
+                return;
+            }
+        }
+
+        Unreachable("Invalid node type");
+    }
 
-    void render(const Node& n);
-    void render(std::span<const Node::Ptr> nodes);
-    virtual void render_macro(const MacroNode& n) = 0;
-    virtual void render_text(str text) = 0;
-    virtual void render_formatting(str formatting) { out += formatting; }
+    void render(std::span<const Node::Ptr> nodes) {
+        for (const auto& n : nodes) Renderer::render(*n);
+    }
+
+    void render_formatting(str formatting) override { out += formatting; }
+
+private:
+    auto self() -> Derived& { return static_cast<Derived&>(*this); }
+};
+
+/// Passes everything to two renderers, so a field can be rendered e.g.
+/// both with and without formatting from a single parse. Each renderer
+/// skips the arguments of macros independently.
+template <typename First, typename Second>
+class DualRenderer final : public RenderSink {
+    usz skip_first = 0;
+    usz skip_second = 0;
+
+    /// For each macro whose arguments we’re rendering, which of the two
+    /// renderers accepted it.
+    std::vector<u8> open_macros;
+
+public:
+    First first;
+    Second second;
+
+    DualRenderer(First first, Second second) : first{std::move(first)}, second{std::move(second)} {}
+
+    void render_text(str text) override {
+        if (not skip_first) first.render_text(text);
+        if (not skip_second) second.render_text(text);
+    }
+
+    void render_formatting(str formatting) override {
+        if (not skip_first) first.render_formatting(formatting);
+        if (not skip_second) second.render_formatting(formatting);
+    }
+
+    bool begin_macro(Macro m) override {
+        bool a = not skip_first and first.begin_macro(m);
+        bool b = not skip_second and second.begin_macro(m);
+        if (not a and not b) return false;
+        skip_first += not a;
+        skip_second += not b;
+        open_macros.push_back(u8(a | b << 1));
+        return true;
+    }
+
+    void end_macro(Macro m) override {
+        auto accepted = open_macros.back();
+        open_macros.pop_back();
+        if (accepted & 1) first.end_macro(m);
+        else skip_first--;
+        if (accepted & 2) second.end_macro(m);
+        else skip_second--;
+    }
+
+    void render(const Node& n) override {
+        if (not skip_first) first.render(n);
+        if (not skip_second) second.render(n);
+    }
+};
+
+/// Macros defined by a language.
+///
+/// Languages add their macros to this once, in 'LanguageOps::register_macros()'.
+/// The parser looks up every macro that isn’t builtin in here before it falls
+/// back to 'LanguageOps::handle_unknown_macro()', which remains available for
+/// macros that need to parse their input themselves.
+class MacroRegistry {
+public:
+    /// Expands a macro; this is passed the arguments of the macro, which
+    /// have already been parsed.
+    using Handler = std::function<auto(TexParser&, std::span<const Node::Ptr> args) -> Result<Node::Ptr>>;
+
+    struct Definition {
+        /// Number of arguments; each one must be enclosed in braces.
+        usz arity;
+        Handler handler;
+    };
+
+private:
+    struct Hash {
+        using is_transparent = void;
+        auto operator()(std::string_view s) const -> usz { return std::hash<std::string_view>{}(s); }
+    };
+
+    std::unordered_map<std::string, Definition, Hash, std::equal_to<>> definitions;
+
+public:
+    /// Define a macro that takes 'arity' arguments.
+    void add(str name, usz arity, Handler handler);
+
+    /// Define a macro that takes no arguments and expands to text, which
+    /// is escaped like any other text.
+    void add_text(str name, str expansion);
+
+    /// Define a macro that takes no arguments and expands to formatting,
+    /// which is inserted literally and dropped if formatting is stripped.
+    void add_formatting(str name, str expansion);
+
+    /// Look up a macro by name, without the leading backslash.
+    [[nodiscard]] auto find(str name) const -> const Definition*;
 };
 
 /// Language-specific operations.
 struct LanguageOps {
+private:
+    MacroRegistry registry;
+    std::once_flag macros_registered;
+
+public:
     virtual ~LanguageOps() = default;
 
     /// Sort headwords. Should return 'true' if 'a' is to be sorted before 'b'.
@@ -155,7 +419,51 @@ struct LanguageOps {
         return a_nfkd == b_nfkd ? a < b : a_nfkd < b_nfkd;
     }
 
-    /// Handle an unknown macro.
+    /// Compute a binary sort key for a headword.
+    ///
+    /// If this returns a key for every entry, the entries are sorted by
+    /// comparing their keys bytewise instead of by calling 'collate()',
+    /// which is much faster since the keys only need to be computed once
+    /// per entry. Keys must order entries the same way 'collate()' does.
+    ///
+    /// The default implementation returns nothing, since it can’t know
+    /// whether 'collate()' has been overridden; languages that use the
+    /// default 'collate()' can return 'DefaultSortKey()' here.
+    [[nodiscard]] virtual auto sort_key(str32 /*word*/, str32 /*nfkd*/) -> std::optional<std::string> {
+        return std::nullopt;
+    }
+
+    /// Sort key that orders headwords the same way the default 'collate()' does.
+    [[nodiscard]] static auto DefaultSortKey(str32 word, str32 nfkd) -> std::string {
+        // Encode each code point as 3 big-endian bytes, offset by one so
+        // we can use 0 as a terminator that sorts before everything else.
+        std::string key;
+        key.reserve((word.size() + nfkd.size() + 1) * 3);
+        auto Append = [&](char32_t c) {
+            auto v = u32(c) + 1;
+            key += char(v >> 16 & 0xFF);
+            key += char(v >> 8 & 0xFF);
+            key += char(v & 0xFF);
+        };
+
+        for (auto c : nfkd) Append(c);
+        key.append(3, '\0');
+        for (auto c : word) Append(c);
+        return key;
+    }
+
+    /// Define the language’s macros; this is called once, before the
+    /// first macro that isn’t builtin is looked up.
+    virtual void register_macros(MacroRegistry&) {}
+
+    /// Get the macros defined by the language.
+    [[nodiscard]] auto macros() -> const MacroRegistry& {
+        std::call_once(macros_registered, [&] { register_macros(registry); });
+        return registry;
+    }
+
+    /// Handle an unknown macro; this is only called for macros that
+    /// aren’t builtin or in the registry.
     ///
     /// \param macro The macro name, *without* the leading backslash.
     virtual auto handle_unknown_macro(TexParser&, str macro) -> Result<Node::Ptr> {
@@ -163,13 +471,37 @@ struct LanguageOps {
     }
 
     /// Preprocess the fields before conversion is attempted.
-    virtual auto preprocess_full_entry(std::vector<std::u32string>&) -> Result<> { return {}; }
+    ///
+    /// The fields are in UTF-8 and exclude the headword.
+    virtual auto preprocess_full_entry(std::vector<std::string>&) -> Result<> { return {}; }
+
+    /// Get a tag that identifies the version of the language’s rules.
+    ///
+    /// This is used to invalidate cached output; change it whenever
+    /// anything in here changes that affects the output for an entry.
+    [[nodiscard]] virtual auto version_tag() -> std::string { return ""; }
 
     /// Convert the language’s text to IPA.
     ///
     /// This can return an empty string if we don’t care about including
     /// a phonetic representation of the word.
     [[nodiscard]] virtual auto to_ipa(str) -> Result<std::string> = 0;
+
+    /// Convert many words to IPA at once.
+    ///
+    /// The generator calls this before emission with every word that a
+    /// backend is going to convert, so languages whose conversion is
+    /// cheaper in bulk can override this. It may be called concurrently
+    /// on disjoint batches if the generator uses multiple threads. The
+    /// result must contain exactly one element per word, in order.
+    ///
+    /// The default implementation calls 'to_ipa()' for each word.
+    [[nodiscard]] virtual auto to_ipa_batch(std::span<const str> words) -> std::vector<Result<std::string>> {
+        std::vector<Result<std::string>> results;
+        results.reserve(words.size());
+        for (auto w : words) results.push_back(to_ipa(w));
+        return results;
+    }
 };
 }
 
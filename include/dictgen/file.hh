@@ -0,0 +1,43 @@
+#ifndef DICTIONARY_GENERATOR_FILE_HH
+#define DICTIONARY_GENERATOR_FILE_HH
+
+#include <base/Base.hh>
+#include <filesystem>
+
+namespace dict {
+using namespace base;
+
+/// Read-only view of the contents of a file.
+///
+/// The file is memory-mapped where possible, so opening even a large
+/// file is cheap and its contents are backed by the page cache; on
+/// platforms where we don’t support that, it is read into memory.
+class MappedFile {
+    const char* ptr = nullptr;
+    usz len = 0;
+    bool mapped = false;
+    std::string fallback;
+
+    MappedFile() = default;
+
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile();
+
+    /// Open a file.
+    [[nodiscard]] static auto Open(const std::filesystem::path& path) -> Result<MappedFile>;
+
+    /// Get the contents of the file.
+    [[nodiscard]] auto contents() const -> str {
+        return mapped ? str{std::string_view{ptr, len}} : str{fallback};
+    }
+
+private:
+    void Unmap();
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_FILE_HH
@@ -4,12 +4,17 @@
 #include <base/Base.hh>
 #include <base/Text.hh>
 #include <dictgen/backends.hh>
+#include <dictgen/cache.hh>
+#include <dictgen/file.hh>
+#include <dictgen/sink.hh>
+#include <dictgen/transliterator.hh>
+#include <array>
 
 namespace dict {
 using namespace base;
 struct Entry {
     /// Headword.
-    std::u32string word;
+    std::string word;
 
     /// Line this entry starts on.
     i64 line = 0;
@@ -20,34 +25,203 @@ struct Entry {
     /// Data.
     Variant<RefEntry, FullEntry> data;
 
+    /// Hash of the line this entry was parsed from.
+    u64 source_hash = 0;
+
+    /// Binary sort key, if the language provides one.
+    std::optional<std::string> sort_key{};
+
+    /// Backends that this entry is for, as set by '$backend'.
+    BackendTag tag = BackendTag::All;
+
+    /// Headword in UTF-32, for 'LanguageOps::collate()'; this is only
+    /// kept if there is no sort key, and only computed for entries that
+    /// have one if some other entry doesn’t.
+    std::u32string word32{};
+
     void emit(Backend& backend) const;
 };
 
 struct EmitResult {
     std::string backend_output;
     bool has_error = false;
+
+    /// Time spent in each phase of generation, across everything that
+    /// the generator has done so far.
+    Profile profile{};
 };
 
 class Generator {
-    /// Backend that we’re emitting code to.
-    Backend& backend;
+    /// A logical line of the input, i.e. a line and all of its
+    /// continuation lines, and everything that was parsed from it.
+    struct LogicalLine {
+        /// Line number that diagnostics and entries are attributed to.
+        i64 line;
+
+        /// The text of the line, if it could be used as-is; this points
+        /// into the input.
+        str borrowed{};
+
+        /// The text of the line, if we had to modify it.
+        std::string owned{};
+
+        /// Diagnostics issued for this line, in order.
+        std::vector<std::string> errors;
+
+        /// Entries parsed from this line.
+        std::vector<Entry> entries;
+
+        /// Hash of the text of this line.
+        u64 hash = 0;
+
+        /// Backends that this line, its entries, and its diagnostics
+        /// are for, as set by '$backend'.
+        BackendTag tag = BackendTag::All;
+
+        /// Get the text of the line; this may be empty if this only
+        /// records a diagnostic.
+        [[nodiscard]] auto text() const -> str {
+            return owned.empty() ? borrowed : str{owned};
+        }
+
+        /// Record an error for this line.
+        template <typename... Args>
+        void error(std::format_string<Args...> fmt, Args&&... args) {
+            errors.push_back(std::format(fmt, LIBBASE_FWD(args)...));
+        }
+    };
+
+    /// Backends that we’re emitting code to; they all share the
+    /// parsed and sorted entries.
+    std::vector<Backend*> backends;
 
     /// Entries we have parsed.
     std::vector<Entry> entries;
 
-    /// A transliterator used to normalise headwords for sorting.
-    text::Transliterator transliterator{"NFKD; [:M:] Remove; [:Punctuation:] Remove; NFC; Lower;"};
+    /// Rules used to normalise headwords for sorting.
+    static constexpr str SortRules = "NFKD; [:M:] Remove; [:Punctuation:] Remove; NFC; Lower;";
+
+    /// Maximum number of threads to use.
+    usz threads;
+
+    /// Maximum number of threads to use to emit into a single backend;
+    /// emit_all() splits 'threads' between the backends that it emits
+    /// into concurrently.
+    usz backend_threads;
+
+    /// Cache for the output of individual entries.
+    OutputCache* cache = nullptr;
+
+    /// Timings for each phase; this is shared with the backends.
+    Profiler profiler;
+
+    /// IPA transcriptions computed by precompute_ipa(); these are shared
+    /// by all backends.
+    IpaTable ipa;
 
 public:
-    explicit Generator(Backend& backend) : backend(backend) {}
+    /// Create a generator.
+    ///
+    /// If 'threads' is greater than 1, entries are built and emitted on
+    /// that many worker threads; the output is the same as if everything
+    /// had been done on a single thread. Note that this means that the
+    /// methods of 'LanguageOps' may be called concurrently.
+    explicit Generator(Backend& backend, usz threads = 1)
+        : Generator(std::span<Backend* const>{std::array{&backend}}, threads) {}
+
+    /// Create a generator that emits the same input into several backends.
+    ///
+    /// The input is parsed and sorted once; '$backend' sections are kept
+    /// as part of each entry, and every backend only gets the entries and
+    /// diagnostics that are meant for it. All backends must use the same
+    /// 'LanguageOps'.
+    explicit Generator(std::span<Backend* const> backends, usz threads = 1);
+
+    /// Detach the backends from the profiler, IPA table, and IPA cache
+    /// that this generator attached to them.
+    ~Generator();
+
+    /// Emit everything into every backend.
+    ///
+    /// If there are multiple threads, the backends are emitted into
+    /// concurrently, and the threads are split between them. If
+    /// 'sinks' is not empty, it must contain a sink for each backend,
+    /// and the output of each backend is written to its sink as if by
+    /// emit_to(); otherwise, it is returned.
+    [[nodiscard]] auto emit_all(std::span<OutputSink* const> sinks = {}) -> std::vector<EmitResult>;
+
+    /// Emit everything to the standard output, or the errors to the
+    /// standard error; returns the exit code.
     [[nodiscard]] int emit();
+
+    /// Emit everything into a sink.
+    ///
+    /// If the backend supports it, output is passed to the sink after
+    /// every entry rather than being collected in memory first. If there
+    /// are errors, the output is returned in 'EmitResult::backend_output'
+    /// instead; if parts of it have already been written to the sink,
+    /// the errors are written to it as well.
+    ///
+    /// With multiple threads, entries are emitted in chunks, and each
+    /// chunk is written to the sink before the next one is started. If an
+    /// output cache is used, the entries that are not in it are emitted
+    /// all at once and held in memory until they have been written.
+    [[nodiscard]] auto emit_to(OutputSink& sink) -> EmitResult;
+
+    /// Emit everything and return the output.
     [[nodiscard]] auto emit_to_string() -> EmitResult;
     void parse(str input_text);
 
+    /// Parse a file.
+    ///
+    /// The file is memory-mapped, and logical lines borrow their text
+    /// from the mapping instead of copying it. The fields of each entry
+    /// are still copied out, since they outlive the mapping, which is
+    /// released before this returns. Diagnostics are the same as if the
+    /// contents of the file had been passed to parse().
+    [[nodiscard]] auto parse_file(const std::filesystem::path& path) -> Result<>;
+
+    /// Reuse the output for entries that haven’t changed since the
+    /// cache was last saved; the cache is updated with the output of
+    /// any entries that had to be emitted again.
+    void use_cache(OutputCache& c) { cache = &c; }
+
+    /// Look up IPA transcriptions in a cache before calling 'LanguageOps::to_ipa()'.
+    ///
+    /// The cache must have been created for the language’s current version
+    /// tag; any transcriptions that had to be computed are added to it.
+    void use_ipa_cache(IpaCache& c) {
+        Assert(c.version_tag() == ops().version_tag(), "IPA cache was created for a different version tag");
+        for (auto b : backends) b->ipa_cache = &c;
+    }
+
 private:
-    void create_full_entry(std::u32string word, std::vector<std::u32string> parts);
-    bool disallow_specials(str32 text, str message);
-    [[nodiscard]] auto ops() -> LanguageOps& { return backend.ops; }
+    void create_full_entry(
+        LogicalLine& l,
+        text::Transliterator& transliterator,
+        std::string word,
+        std::vector<std::string> parts
+    );
+
+    void add_entry(
+        LogicalLine& l,
+        text::Transliterator& transliterator,
+        std::string word,
+        Variant<RefEntry, FullEntry> data
+    );
+
+    bool disallow_specials(LogicalLine& l, str text, str message);
+    auto emit_backend(Backend& backend, OutputSink* sink, bool ipa_precomputed = false) -> EmitResult;
+    void emit_cached(Backend& backend, OutputSink* sink);
+    void emit_entries(Backend& backend, OutputSink* sink);
+    void flush_output(Backend& backend, OutputSink* sink);
+    auto fork_backend(Backend& backend, usz count) -> std::vector<std::unique_ptr<Backend>>;
+    void parse_line(LogicalLine& l, text::Transliterator& transliterator);
+    void precompute_ipa(Backend& backend, std::span<const usz> pending);
+    void sort_entries();
+    auto split_lines(str input_text) -> std::vector<LogicalLine>;
+    [[nodiscard]] auto ops() -> LanguageOps& { return backends.front()->ops; }
+    [[nodiscard]] auto pending_entries(const Backend& backend) const -> std::vector<usz>;
 };
 } // namespace dict
 
@@ -1,7 +1,6 @@
 #ifndef DICTIONARY_GENERATOR_PARSER_HH
 #define DICTIONARY_GENERATOR_PARSER_HH
 
-#include <base/FixedVector.hh>
 #include <dictgen/core.hh>
 
 namespace dict {
@@ -11,17 +10,41 @@ class ConversionBackend;
 class TexParser {
     Backend& backend;
 
+    /// Arena that nodes are allocated in.
+    Arena& arena;
+
+    /// Nodes of the groups we’re currently parsing.
+    std::vector<Node::Ptr> stack;
+
+    /// Receives the output if we’re rendering in a single pass; this is
+    /// null if we’re building a tree.
+    RenderSink* sink = nullptr;
+
+    /// If nonzero, we’re streaming the arguments of a macro that the sink
+    /// doesn’t want, so we discard everything.
+    usz skip_depth = 0;
+
 public:
     str input;
 
 private:
-    explicit TexParser(Backend& backend, str input)
-        : backend(backend), input(input) {}
+    explicit TexParser(Backend& backend, str input);
 
 public:
     /// Run the converter.
+    ///
+    /// The nodes are allocated in the backend’s arena and remain valid
+    /// until it is reset.
     static auto Parse(Backend& backend, str input) -> Result<Node::Ptr>;
 
+    /// Parse and render in a single pass, without building a tree.
+    ///
+    /// Builtin macros and text are passed to the sink as they are parsed;
+    /// macros that are handled by the language ops are still parsed into
+    /// a tree, which is passed to 'sink.render()'. Nothing that was passed
+    /// to the sink is meaningful if this returns an error.
+    static auto Render(Backend& backend, str input, RenderSink& sink) -> Result<>;
+
     /// Check what target we’re compiling for.
     template <std::derived_from<Backend> T>
     bool backend_is() {
@@ -30,9 +53,8 @@ public:
 
     /// Make a group node.
     auto group(auto ...nodes) -> Node::Ptr {
-        std::vector<Node::Ptr> children;
-        (children.push_back(std::move(nodes)), ...);
-        return Make<ContentNode>(std::move(children));
+        std::array<Node::Ptr, sizeof...(nodes)> children{std::move(nodes)...};
+        return Make<ContentNode>(arena.copy(std::span<const Node::Ptr>{children}));
     }
 
     /// Parse a group. This can be invoked by macro handlers to parse macro arguments.
@@ -40,28 +62,40 @@ public:
 
     /// Make a formatting node; text passed to this will be inserted literally and
     /// stripped out entirely in context were we don’t care about formatting.
-    auto formatting(std::string text) -> Node::Ptr {
-        return Make<FormattingNode>(std::move(text));
+    auto formatting(str text) -> Node::Ptr {
+        return Make<FormattingNode>(arena.copy(text));
     }
 
     /// Make a text node; text passed to this will be escaped.
-    auto text(std::string text) -> Node::Ptr {
-        return Make<ComputedTextNode>(std::move(text));
+    auto text(str text) -> Node::Ptr {
+        return Make<ComputedTextNode>(arena.copy(text));
     }
 
 private:
     /// Create a node.
     template <typename NodeType, typename ...Args>
-    static auto Make(Args&& ...args) -> Node::Ptr {
-        return Node::Ptr(std::make_unique<NodeType>(std::forward<Args>(args)...));
+    auto Make(Args&& ...args) -> Node::Ptr {
+        static_assert(std::is_trivially_destructible_v<NodeType>, "Nodes are never destroyed");
+        return Node::Ptr(arena.make<NodeType>(std::forward<Args>(args)...));
     }
 
+    /// Move the nodes on the stack starting at 'start' into the arena.
+    auto PopNodes(usz start) -> std::span<const Node::Ptr>;
+
+    /// Add output to the tree or pass it to the sink.
+    void AddComputedText(str text);
+    void AddEmpty();
+    void AddMacro(Macro m);
+    void AddNode(Node::Ptr node);
+    void AddText(str text);
+
+    auto ExpandMacro(const MacroRegistry::Definition& def) -> Result<Node::Ptr>;
     auto HandleUnknownMacro(str macro) -> Result<Node::Ptr>;
-    auto ParseContent(std::vector<Node::Ptr>& nodes, i32 braces) -> Result<>;
+    auto ParseContent(i32 braces) -> Result<>;
     auto ParseGroup() -> Result<Node::Ptr>;
-    auto ParseMacro() -> Result<Node::Ptr>;
-    auto ParseMaths() -> Result<Node::Ptr>;
-    auto ParseSingleArgumentMacro(Macro m) -> Result<Node::Ptr>;
+    auto ParseMacro() -> Result<>;
+    auto ParseMaths() -> Result<>;
+    auto ParseSingleArgumentMacro(Macro m) -> Result<>;
 };
 }
 
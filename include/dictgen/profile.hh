@@ -0,0 +1,144 @@
+#ifndef DICTIONARY_GENERATOR_PROFILE_HH
+#define DICTIONARY_GENERATOR_PROFILE_HH
+
+#include <base/Base.hh>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dict {
+using namespace base;
+
+/// Phases of dictionary generation that we record timings for.
+///
+/// Some of these are nested in others; e.g. 'TexParse' and 'Render'
+/// happen during 'Emit', so the times don’t add up to the total.
+enum class Phase : u8 {
+    Parse,              ///< Generator::parse().
+    Preprocess,         ///< LanguageOps::preprocess_full_entry().
+    SplitSenses,        ///< Splitting definitions into senses and examples.
+    Sort,               ///< Sorting the entries.
+    Emit,               ///< Emitting all entries, including finish().
+    TexParse,           ///< TexParser::Parse(), which builds a tree.
+    Render,             ///< Parsing and rendering a field in a single pass.
+    ToIPA,              ///< LanguageOps::to_ipa().
+    NormaliseForSearch, ///< JsonBackend::NormaliseForSearch().
+    Serialise,          ///< Writing a converted entry to the JSON output.
+    Count,
+};
+
+/// Timings and call counts for each phase.
+///
+/// Phases that run on several threads record the sum of the time spent
+/// on every thread, so they can exceed the wall time of the phase that
+/// contains them.
+struct Profile {
+    /// Whether profiling was enabled at compile time; if not, everything
+    /// in here is always zero.
+#ifdef DICTGEN_ENABLE_PROFILING
+    static constexpr bool Enabled = true;
+#else
+    static constexpr bool Enabled = false;
+#endif
+
+    struct Stats {
+        /// Total time spent in this phase.
+        std::chrono::nanoseconds time{};
+
+        /// Number of times this phase was entered.
+        u64 calls = 0;
+    };
+
+    std::array<Stats, +Phase::Count> phases{};
+
+    [[nodiscard]] auto operator[](Phase p) -> Stats& { return phases[+p]; }
+    [[nodiscard]] auto operator[](Phase p) const -> const Stats& { return phases[+p]; }
+
+    /// Get the name of a phase.
+    [[nodiscard]] static auto Name(Phase p) -> str;
+
+    /// Convert the profile to JSON. This is an object that maps the
+    /// name of each phase to an object containing 'ns' and 'calls'.
+    [[nodiscard]] auto to_json() const -> std::string;
+};
+
+/// Accumulates timings; this can be shared between threads.
+///
+/// Every thread records into its own set of counters, which are only
+/// added up by snapshot(), so threads never write to the same cache
+/// line when they record a call.
+class Profiler {
+    struct Counters {
+        std::atomic<i64> ns{};
+        std::atomic<u64> calls{};
+    };
+
+    /// Counters of a single thread; only that thread writes to them.
+    struct alignas(64) Shard {
+        std::thread::id thread;
+        std::array<Counters, +Phase::Count> counters{};
+    };
+
+    static inline std::atomic<u64> NextId = 1;
+
+    /// Identifies this profiler in the per-thread cache; unlike its
+    /// address, this is never reused.
+    const u64 id = NextId.fetch_add(1, std::memory_order_relaxed);
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+public:
+    /// Record a call to a phase.
+    void record([[maybe_unused]] Phase p, [[maybe_unused]] std::chrono::nanoseconds time) {
+#ifdef DICTGEN_ENABLE_PROFILING
+        thread_local std::pair<u64, Shard*> cached{};
+        if (cached.first != id) cached = {id, &Register()};
+
+        // Only this thread writes to these, so there is no need for an
+        // atomic read-modify-write.
+        auto& c = cached.second->counters[+p];
+        c.ns.store(c.ns.load(std::memory_order_relaxed) + time.count(), std::memory_order_relaxed);
+        c.calls.store(c.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+    }
+
+    /// Get everything that was recorded so far.
+    [[nodiscard]] auto snapshot() const -> Profile;
+
+private:
+    /// Get the counters of the current thread, creating them if need be.
+    auto Register() -> Shard&;
+};
+
+/// Records the time from construction to destruction as a call to a
+/// phase; this does nothing if there is no profiler or if profiling is
+/// disabled.
+class ProfileScope {
+#ifdef DICTGEN_ENABLE_PROFILING
+    using Clock = std::chrono::steady_clock;
+    Profiler* profiler;
+    Phase phase;
+    Clock::time_point start;
+
+public:
+    ProfileScope(Profiler* profiler, Phase phase)
+        : profiler{profiler}, phase{phase}, start{profiler ? Clock::now() : Clock::time_point{}} {}
+
+    ~ProfileScope() {
+        if (profiler) profiler->record(phase, Clock::now() - start);
+    }
+#else
+public:
+    ProfileScope(Profiler*, Phase) {}
+#endif
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_PROFILE_HH
@@ -0,0 +1,59 @@
+#ifndef DICTIONARY_GENERATOR_SCAN_HH
+#define DICTIONARY_GENERATOR_SCAN_HH
+
+#include <base/Base.hh>
+#include <span>
+
+/// Vectorised scanning for the TeX parser and the renderers.
+///
+/// Fields are mostly prose with the occasional macro, so the parser spends
+/// most of its time looking for the next byte that isn’t plain text, and
+/// the renderers for the next byte that they need to escape. These
+/// functions do that 16 or 32 bytes at a time where the CPU supports it;
+/// the best implementation is picked once, at startup.
+namespace dict::scan {
+using namespace base;
+
+/// A set of scanning functions for one instruction set.
+struct Kernels {
+    /// Name of the instruction set, for tests and benchmarks.
+    std::string_view name;
+
+    /// Get the index of the first '\', '$', '{', or '}' in a string, or
+    /// its size if there is none.
+    auto (*find_tex_special)(const char* data, usz size) -> usz;
+
+    /// Get the length of the prefix of a string that can be part of a
+    /// macro name, i.e. ASCII letters and '@'.
+    auto (*count_macro_letters)(const char* data, usz size) -> usz;
+
+    /// Get the index of the first byte that the JSON backend escapes when
+    /// it converts text to HTML, i.e. '<', '>', '&', or '~', or the size of
+    /// the string if there is none.
+    auto (*find_html_escape)(const char* data, usz size) -> usz;
+
+    /// Get the index of the first byte that needs to be escaped in Typst
+    /// markup, or the size of the string if there is none.
+    auto (*find_typst_escape)(const char* data, usz size) -> usz;
+};
+
+/// Get every implementation that the current CPU supports, from slowest
+/// to fastest; the first one is always the portable fallback.
+[[nodiscard]] auto Implementations() -> std::span<const Kernels>;
+
+/// Get the fastest implementation for the current CPU.
+[[nodiscard]] auto Best() -> const Kernels&;
+
+/// Get the index of the first character in 'text' that is special to the
+/// TeX parser, or its size if there is none.
+[[nodiscard]] inline auto FindTexSpecial(str text) -> usz {
+    return Best().find_tex_special(text.data(), text.size());
+}
+
+/// Get the length of the macro name at the start of 'text'.
+[[nodiscard]] inline auto CountMacroLetters(str text) -> usz {
+    return Best().count_macro_letters(text.data(), text.size());
+}
+} // namespace dict::scan
+
+#endif // DICTIONARY_GENERATOR_SCAN_HH
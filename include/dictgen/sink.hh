@@ -0,0 +1,83 @@
+#ifndef DICTIONARY_GENERATOR_SINK_HH
+#define DICTIONARY_GENERATOR_SINK_HH
+
+#include <base/Base.hh>
+#include <filesystem>
+#include <functional>
+
+namespace dict {
+using namespace base;
+
+/// Destination for the output of a generator.
+///
+/// Backends whose output is final as soon as an entry has been emitted
+/// pass it to the sink after every entry, so it never has to be held in
+/// memory all at once; everything else is written when emission is done.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    /// Write a chunk of output.
+    virtual void write(str data) = 0;
+
+    /// Make sure everything that was written has reached its destination,
+    /// and report any errors that occurred while writing.
+    virtual auto flush() -> Result<> { return {}; }
+};
+
+/// Sink that collects the output in a string.
+class StringSink final : public OutputSink {
+public:
+    std::string contents;
+    void write(str data) override { contents += data; }
+};
+
+/// Sink that passes every chunk of output to a function.
+class CallbackSink final : public OutputSink {
+    std::function<void(str)> callback;
+
+public:
+    explicit CallbackSink(std::function<void(str)> callback) : callback{std::move(callback)} {}
+    void write(str data) override { callback(data); }
+};
+
+/// Sink that writes to a file descriptor.
+///
+/// Writes are buffered, and the buffer is written out whenever it fills
+/// up; the first error that occurs is reported by flush(), and anything
+/// written after that is discarded.
+class FileSink final : public OutputSink {
+    static constexpr usz BufferSize = 64 * 1024;
+
+    int fd;
+    bool owned;
+    std::string buffer;
+    std::optional<std::string> write_error;
+
+    FileSink(int fd, bool owned);
+
+public:
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+    FileSink(FileSink&& other) noexcept;
+    FileSink& operator=(FileSink&& other) noexcept;
+    ~FileSink() override;
+
+    /// Create or truncate a file and write to it.
+    [[nodiscard]] static auto Open(const std::filesystem::path& path) -> Result<FileSink>;
+
+    /// Write to the standard output or standard error.
+    [[nodiscard]] static auto Stdout() -> FileSink;
+    [[nodiscard]] static auto Stderr() -> FileSink;
+
+    void write(str data) override;
+    auto flush() -> Result<> override;
+
+private:
+    void Close();
+    void WriteAll(str data);
+    void WriteBuffer();
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_SINK_HH
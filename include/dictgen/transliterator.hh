@@ -0,0 +1,52 @@
+#ifndef DICTIONARY_GENERATOR_TRANSLITERATOR_HH
+#define DICTIONARY_GENERATOR_TRANSLITERATOR_HH
+
+#include <base/Base.hh>
+#include <base/Text.hh>
+#include <memory>
+
+namespace dict {
+using namespace base;
+
+/// Process-wide registry of compiled transliterators.
+///
+/// Compiling transliteration rules is expensive, and a transliterator
+/// can’t be used by multiple threads at once. The registry keeps a pool
+/// of compiled instances for each rule string; a thread that needs one
+/// leases an instance, which goes back into the pool once the lease is
+/// released. Rules are only compiled when there is no free instance,
+/// i.e. once per rule string and concurrent user over the lifetime of
+/// the process.
+class TransliteratorRegistry {
+    struct Pool;
+
+public:
+    /// Exclusive access to a transliterator.
+    class Lease {
+        friend TransliteratorRegistry;
+        Pool* pool = nullptr;
+        std::unique_ptr<text::Transliterator> transliterator;
+
+        Lease(Pool* pool, std::unique_ptr<text::Transliterator> t)
+            : pool{pool}, transliterator{std::move(t)} {}
+
+    public:
+        Lease(Lease&&) noexcept = default;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        [[nodiscard]] auto operator*() const -> text::Transliterator& { return *transliterator; }
+        [[nodiscard]] auto operator->() const -> text::Transliterator* { return transliterator.get(); }
+
+    private:
+        void Release();
+    };
+
+    TransliteratorRegistry() = delete;
+
+    /// Get a transliterator for a set of rules.
+    [[nodiscard]] static auto Acquire(str rules) -> Lease;
+};
+} // namespace dict
+
+#endif // DICTIONARY_GENERATOR_TRANSLITERATOR_HH
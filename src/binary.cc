@@ -0,0 +1,101 @@
+#include <dictgen/binary.hh>
+
+using namespace dict;
+
+auto BinaryDictionary::Open(const std::filesystem::path& path) -> Result<BinaryDictionary> {
+    auto file = std::make_unique<MappedFile>(Try(MappedFile::Open(path)));
+    auto dict = Try(Load(file->contents()));
+    dict.file = std::move(file);
+    return dict;
+}
+
+auto BinaryDictionary::Load(str data) -> Result<BinaryDictionary> {
+    BinaryDictionary dict;
+    dict.data = data;
+    if (data.size() < sizeof(binary::Header)) return Error("Not a binary dictionary: file is too small");
+    std::memcpy(&dict.header, data.data(), sizeof(binary::Header));
+    dict.header = binary::ByteOrder(dict.header);
+
+    auto& h = dict.header;
+    if (h.magic != binary::Magic) return Error("Not a binary dictionary: invalid magic number");
+    if (h.version != binary::Version) return Error(
+        "Unsupported binary dictionary version {}; expected {}",
+        h.version,
+        binary::Version
+    );
+
+    // Make sure every table is in bounds so we only need to check the strings
+    // and indices in a record when we access it.
+    auto CheckTable = [&](str name, u32 offset, u64 size) -> Result<> {
+        if (u64(offset) + size > data.size()) return Error("Corrupt binary dictionary: {} table is out of bounds", name);
+        return {};
+    };
+
+    Try(CheckTable("entry", h.entries, u64(h.entry_count) * sizeof(binary::Entry)));
+    Try(CheckTable("sense", h.senses, u64(h.sense_count) * sizeof(binary::Sense)));
+    Try(CheckTable("example", h.examples, u64(h.example_count) * sizeof(binary::Example)));
+    Try(CheckTable("reference", h.refs, u64(h.ref_count) * sizeof(binary::Ref)));
+    Try(CheckTable("index", h.index, u64(h.index_count) * sizeof(binary::IndexRecord)));
+    Try(CheckTable("string", h.strings, h.strings_size));
+    return dict;
+}
+
+auto BinaryDictionary::entry(usz i) const -> Entry {
+    return {this, Record<binary::Entry>(header.entries, header.entry_count, i)};
+}
+
+auto BinaryDictionary::example(usz i) const -> Example {
+    return {this, Record<binary::Example>(header.examples, header.example_count, i)};
+}
+
+auto BinaryDictionary::lookup(str word) const -> Result<std::vector<Element>> {
+    // A key that is out of bounds can’t be compared, so remember that we saw
+    // one and report it once the search is done.
+    bool corrupt = false;
+    auto Key = [&](u32 i) -> std::string_view {
+        auto key = required(Record<binary::IndexRecord>(header.index, header.index_count, i).key);
+        if (not key.has_value()) {
+            corrupt = true;
+            return {};
+        }
+
+        return {key.value().data(), key.value().size()};
+    };
+
+    // The index is sorted bytewise, so we can just compare string views.
+    std::string_view needle{word.data(), word.size()};
+    auto indices = vws::iota(u32(0), header.index_count);
+    auto it = rgs::partition_point(indices, [&](u32 i) { return Key(i) < needle; });
+
+    std::vector<Element> elements;
+    for (; it != indices.end() and Key(*it) == needle and not corrupt; ++it) {
+        auto rec = Record<binary::IndexRecord>(header.index, header.index_count, *it);
+        if (rec.element >= (rec.is_ref ? header.ref_count : header.entry_count))
+            return Error("Corrupt binary dictionary: index record {} refers to an element that is out of bounds", *it);
+        if (rec.is_ref) elements.emplace_back(ref(rec.element));
+        else elements.emplace_back(entry(rec.element));
+    }
+
+    if (corrupt) return Error("Corrupt binary dictionary: index key is out of bounds");
+    return elements;
+}
+
+auto BinaryDictionary::ref(usz i) const -> Ref {
+    return {this, Record<binary::Ref>(header.refs, header.ref_count, i)};
+}
+
+auto BinaryDictionary::required(binary::StringRef s) const -> Result<str> {
+    auto res = Try(string(s));
+    if (not res) return Error("Corrupt binary dictionary: required string is missing");
+    return *res;
+}
+
+auto BinaryDictionary::sense(usz i) const -> Sense {
+    return {this, Record<binary::Sense>(header.senses, header.sense_count, i)};
+}
+
+auto BinaryDictionary::string(binary::StringRef s) const -> Result<std::optional<str>> {
+    if (s.offset == binary::StringRef::Absent) return std::nullopt;
+    if (u64(s.offset) + s.size > header.strings_size) return Error("Corrupt binary dictionary: string is out of bounds");
+    return str{std::string_view{data.data() + header.strings + s.offset, s.size}};
+}
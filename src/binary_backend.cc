@@ -0,0 +1,203 @@
+#include <dictgen/backends.hh>
+#include <dictgen/binary.hh>
+#include <limits>
+
+using namespace dict;
+
+namespace {
+/// String table that stores each distinct string once.
+class StringTable {
+    std::string data;
+    std::unordered_map<std::string, u32> offsets;
+
+public:
+    auto add(str s) -> binary::StringRef {
+        auto [it, inserted] = offsets.try_emplace(s.string(), u32(data.size()));
+        if (inserted) data += s;
+        return {it->second, u32(s.size())};
+    }
+
+    auto add(const std::optional<std::string>& s) -> binary::StringRef {
+        return s ? add(str(*s)) : binary::StringRef{};
+    }
+
+    [[nodiscard]] auto contents() const -> const std::string& { return data; }
+};
+
+template <typename T>
+void Append(std::string& out, const T& record) {
+    auto rec = binary::ByteOrder(record);
+    out.append(reinterpret_cast<const char*>(&rec), sizeof(T));
+}
+
+template <typename T>
+void Append(std::string& out, const std::vector<T>& records) {
+    if constexpr (std::endian::native == std::endian::little) {
+        out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+    } else {
+        for (const auto& rec : records) Append(out, rec);
+    }
+}
+}
+
+BinaryBackend::BinaryBackend(LanguageOps& ops)
+    : Backend{ops}, html{ops, false, false, false} {}
+
+// Forward our state to the JSON backend that does the actual conversion.
+void BinaryBackend::BeginConversion() {
+    html.line = line;
+    html.profiler = profiler;
+    html.ipa_cache = ipa_cache;
+    html.precomputed_ipa = precomputed_ipa;
+}
+
+void BinaryBackend::EndConversion() {
+    if (not std::exchange(html.has_error, false)) return;
+    has_error = true;
+    errors += std::exchange(html.errors, {});
+}
+
+void BinaryBackend::emit(str word, const FullEntry& data) {
+    BeginConversion();
+    entries.push_back(html.ConvertEntry(word, data));
+    EndConversion();
+}
+
+void BinaryBackend::emit(str word, const RefEntry& data) {
+    BeginConversion();
+    refs.push_back(html.ConvertRef(word, data));
+    EndConversion();
+}
+
+void BinaryBackend::emit_error(std::string error) {
+    errors += error;
+    if (not errors.ends_with('\n')) errors += "\n";
+}
+
+auto BinaryBackend::fork() -> std::unique_ptr<Backend> {
+    return New<BinaryBackend>(ops);
+}
+
+void BinaryBackend::join(Backend& b) {
+    auto& fork = static_cast<BinaryBackend&>(b);
+    has_error |= std::exchange(fork.has_error, false);
+    errors += std::exchange(fork.errors, {});
+    rgs::move(fork.entries, std::back_inserter(entries));
+    rgs::move(fork.refs, std::back_inserter(refs));
+    fork.entries.clear();
+    fork.refs.clear();
+}
+
+auto BinaryBackend::ipa_source(str word, const FullEntry& data) -> std::optional<std::string> {
+    return html.ipa_source(word, data);
+}
+
+void BinaryBackend::finish() {
+    if (has_error) {
+        output = std::move(errors);
+        return;
+    }
+
+    StringTable strings;
+    std::vector<binary::Entry> entry_records;
+    std::vector<binary::Sense> sense_records;
+    std::vector<binary::Example> example_records;
+    std::vector<binary::Ref> ref_records;
+
+    auto AddSense = [&](const JsonBackend::HtmlSense& s) {
+        sense_records.push_back({
+            .def = strings.add(str(s.def)),
+            .comment = strings.add(s.comment),
+            .first_example = u32(example_records.size()),
+            .example_count = u32(s.examples.size()),
+        });
+
+        for (auto& ex : s.examples) example_records.push_back({strings.add(str(ex.text)), strings.add(ex.comment)});
+        return u32(sense_records.size() - 1);
+    };
+
+    // Senses of an entry must be contiguous, so add the primary definition first.
+    for (auto& e : entries) {
+        auto& rec = entry_records.emplace_back(binary::Entry{
+            .word = strings.add(str(e.word)),
+            .pos = strings.add(str(e.pos)),
+            .ipa = strings.add(str(e.ipa)),
+            .etym = strings.add(e.etym),
+            .forms = strings.add(e.forms),
+            .hw_search = strings.add(str(e.hw_search)),
+            .def_search = strings.add(str(e.def_search)),
+            .def = e.def ? AddSense(*e.def) : binary::NoSense,
+            .first_sense = 0,
+            .sense_count = u32(e.senses.size()),
+        });
+
+        rec.first_sense = u32(sense_records.size());
+        for (auto& s : e.senses) AddSense(s);
+    }
+
+    for (auto& r : refs) {
+        ref_records.push_back({
+            .from = strings.add(str(r.from)),
+            .from_search = strings.add(str(r.from_search)),
+            .to = strings.add(str(r.to)),
+        });
+    }
+
+    // Build the headword index. This is sorted bytewise so readers don’t
+    // need to know anything about collation; entries come first since we
+    // use a stable sort.
+    std::vector<std::pair<std::string_view, binary::IndexRecord>> index;
+    for (auto [i, e] : utils::enumerate(entries)) index.emplace_back(e.stripped_word, binary::IndexRecord{strings.add(str(e.stripped_word)), u32(i), 0});
+    for (auto [i, r] : utils::enumerate(refs)) index.emplace_back(r.stripped_from, binary::IndexRecord{strings.add(str(r.stripped_from)), u32(i), 1});
+    rgs::stable_sort(index, {}, &std::pair<std::string_view, binary::IndexRecord>::first);
+    auto index_records = index | vws::values | rgs::to<std::vector>();
+
+    // Lay out the file.
+    binary::Header h{
+        .magic = binary::Magic,
+        .version = binary::Version,
+        .entry_count = u32(entry_records.size()),
+        .sense_count = u32(sense_records.size()),
+        .example_count = u32(example_records.size()),
+        .ref_count = u32(ref_records.size()),
+        .index_count = u32(index_records.size()),
+        .entries = 0,
+        .senses = 0,
+        .examples = 0,
+        .refs = 0,
+        .index = 0,
+        .strings = 0,
+        .strings_size = u32(strings.contents().size()),
+    };
+
+    u64 offset = sizeof(binary::Header);
+    auto Place = [&]<typename T>(u32& field, const std::vector<T>& records) {
+        field = u32(offset);
+        offset += records.size() * sizeof(T);
+    };
+
+    Place(h.entries, entry_records);
+    Place(h.senses, sense_records);
+    Place(h.examples, example_records);
+    Place(h.refs, ref_records);
+    Place(h.index, index_records);
+    h.strings = u32(offset);
+    offset += strings.contents().size();
+    if (offset > std::numeric_limits<u32>::max()) {
+        output = "Dictionary is too large for the binary format\n";
+        has_error = true;
+        return;
+    }
+
+    output.clear();
+    output.reserve(usz(offset));
+    Append(output, h);
+    Append(output, entry_records);
+    Append(output, sense_records);
+    Append(output, example_records);
+    Append(output, ref_records);
+    Append(output, index_records);
+    output += strings.contents();
+    entries.clear();
+    refs.clear();
+}
@@ -0,0 +1,169 @@
+#include <dictgen/cache.hh>
+#include <fstream>
+
+using namespace dict;
+
+namespace {
+// Note: cache files are meant to be local to a machine, so we
+// just use the native byte order.
+constexpr std::string_view Magic = "DGOC";
+constexpr std::string_view IpaMagic = "DGIC";
+constexpr u32 Version = 1;
+
+template <typename T>
+bool Read(std::istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+void Write(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+bool ReadString(std::istream& in, std::string& s) {
+    u64 size{};
+    if (not Read(in, size)) return false;
+    s.resize(size);
+    return bool(in.read(s.data(), std::streamsize(size)));
+}
+
+void WriteString(std::ostream& out, std::string_view s) {
+    Write(out, u64(s.size()));
+    out.write(s.data(), std::streamsize(s.size()));
+}
+
+/// Check the magic number and version of a cache file.
+bool ReadHeader(std::istream& in, std::string_view magic) {
+    char buffer[4]{};
+    u32 version{};
+    return in.read(buffer, std::ssize(buffer)) and
+           std::string_view{buffer, std::size(buffer)} == magic and
+           Read(in, version) and
+           version == Version;
+}
+
+void WriteHeader(std::ostream& out, std::string_view magic) {
+    out.write(magic.data(), std::ssize(magic));
+    Write(out, Version);
+}
+
+/// Write a file via a temporary file so we never leave a truncated
+/// cache behind if we’re interrupted.
+template <typename Callback>
+auto WriteAtomically(const std::filesystem::path& path, Callback write) -> Result<> {
+    auto tmp = path;
+    tmp += ".tmp";
+
+    {
+        std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+        if (not out) return Error("Could not open '{}' for writing", tmp.string());
+        write(out);
+        if (not out.flush()) return Error("Could not write to '{}'", tmp.string());
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) return Error("Could not write '{}': {}", path.string(), ec.message());
+    return {};
+}
+}
+
+auto OutputCache::Load(const std::filesystem::path& path) -> OutputCache {
+    OutputCache cache;
+    std::ifstream in{path, std::ios::binary};
+    if (not in) return cache;
+
+    // Check the header.
+    u64 count{};
+    if (not ReadHeader(in, Magic) or not Read(in, count)) return cache;
+
+    // Read the fragments. Discard everything if the file is truncated.
+    for (u64 i = 0; i < count; i++) {
+        u64 key{};
+        std::string fragment;
+        if (not Read(in, key) or not ReadString(in, fragment)) return {};
+        cache.fragments[key] = std::move(fragment);
+    }
+
+    return cache;
+}
+
+auto OutputCache::find(u64 key) -> const std::string* {
+    auto it = fragments.find(key);
+    if (it == fragments.end()) return nullptr;
+    used.insert(key);
+    return &it->second;
+}
+
+void OutputCache::insert(u64 key, std::string fragment) {
+    fragments[key] = std::move(fragment);
+    used.insert(key);
+}
+
+auto OutputCache::save(const std::filesystem::path& path) const -> Result<> {
+    return WriteAtomically(path, [&](std::ostream& out) {
+        WriteHeader(out, Magic);
+        Write(out, u64(used.size()));
+        for (auto key : used) {
+            Write(out, key);
+            WriteString(out, fragments.at(key));
+        }
+    });
+}
+
+auto IpaCache::Load(const std::filesystem::path& path, std::string version_tag) -> IpaCache {
+    std::ifstream in{path, std::ios::binary};
+    if (not in) return IpaCache{std::move(version_tag)};
+
+    // Check the header; the cache is useless if the rules have changed.
+    std::string version;
+    u64 count{};
+    if (
+        not ReadHeader(in, IpaMagic) or
+        not ReadString(in, version) or
+        version != version_tag or
+        not Read(in, count)
+    ) return IpaCache{std::move(version_tag)};
+
+    // Read the transcriptions. Discard everything if the file is truncated.
+    std::unordered_map<std::string, std::string> transcriptions;
+    for (u64 i = 0; i < count; i++) {
+        std::string word, ipa;
+        if (not ReadString(in, word) or not ReadString(in, ipa)) return IpaCache{std::move(version_tag)};
+        transcriptions[std::move(word)] = std::move(ipa);
+    }
+
+    return IpaCache{std::move(version_tag), std::move(transcriptions)};
+}
+
+auto IpaCache::find(str word) -> std::optional<std::string> {
+    std::unique_lock lock{mutex};
+    auto it = transcriptions.find(word.string());
+    if (it == transcriptions.end()) return std::nullopt;
+    used.insert(it->first);
+    return it->second;
+}
+
+void IpaCache::insert(str word, std::string ipa) {
+    std::unique_lock lock{mutex};
+    auto [it, _] = transcriptions.insert_or_assign(word.string(), std::move(ipa));
+    used.insert(it->first);
+}
+
+auto IpaCache::save(const std::filesystem::path& path) const -> Result<> {
+    std::unique_lock lock{mutex};
+    return WriteAtomically(path, [&](std::ostream& out) {
+        WriteHeader(out, IpaMagic);
+        WriteString(out, version);
+        Write(out, u64(used.size()));
+        for (auto& word : used) {
+            WriteString(out, word);
+            WriteString(out, transcriptions.at(word));
+        }
+    });
+}
+
+auto IpaCache::size() const -> usz {
+    std::unique_lock lock{mutex};
+    return transcriptions.size();
+}
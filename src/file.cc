@@ -0,0 +1,76 @@
+#include <dictgen/file.hh>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    define DICTGEN_USE_MMAP 1
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+using namespace dict;
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : ptr{std::exchange(other.ptr, nullptr)},
+      len{std::exchange(other.len, 0)},
+      mapped{std::exchange(other.mapped, false)},
+      fallback{std::move(other.fallback)} {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this == &other) return *this;
+    Unmap();
+    ptr = std::exchange(other.ptr, nullptr);
+    len = std::exchange(other.len, 0);
+    mapped = std::exchange(other.mapped, false);
+    fallback = std::move(other.fallback);
+    return *this;
+}
+
+MappedFile::~MappedFile() { Unmap(); }
+
+auto MappedFile::Open(const std::filesystem::path& path) -> Result<MappedFile> {
+    MappedFile f;
+
+#ifdef DICTGEN_USE_MMAP
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return Error("Could not open '{}': {}", path.string(), std::strerror(errno));
+    defer { ::close(fd); };
+
+    struct stat st{};
+    if (::fstat(fd, &st) < 0) return Error("Could not stat '{}': {}", path.string(), std::strerror(errno));
+
+    // mmap() doesn’t support empty mappings, and we don’t need one anyway.
+    if (st.st_size == 0) return f;
+
+    auto size = usz(st.st_size);
+    auto mem = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem != MAP_FAILED) {
+        // We read the file front to back exactly once.
+        (void) ::madvise(mem, size, MADV_SEQUENTIAL);
+        f.ptr = static_cast<const char*>(mem);
+        f.len = size;
+        f.mapped = true;
+        return f;
+    }
+
+    // Some file systems don’t support mmap(); fall back to reading the file.
+#endif
+
+    std::ifstream in{path, std::ios::binary};
+    if (not in) return Error("Could not open '{}'", path.string());
+    f.fallback.assign(std::istreambuf_iterator<char>{in}, {});
+    if (in.bad()) return Error("Could not read '{}'", path.string());
+    return f;
+}
+
+void MappedFile::Unmap() {
+#ifdef DICTGEN_USE_MMAP
+    if (mapped) ::munmap(const_cast<char*>(ptr), len);
+#endif
+    ptr = nullptr;
+    len = 0;
+    mapped = false;
+}
@@ -1,58 +1,120 @@
 #include <base/Text.hh>
 #include <dictgen/frontend.hh>
+#include <atomic>
+#include <numeric>
 #include <print>
+#include <thread>
+#include <unordered_set>
 
 using namespace dict;
 
 namespace {
-constexpr str32 SenseMacroU32 = U"\\\\";
-constexpr str32 Apostrophe = U"'`’\N{MODIFIER LETTER APOSTROPHE}";
+constexpr str SenseMacro = "\\\\";
+constexpr str Apostrophes[]{"'", "`", "’", "\N{MODIFIER LETTER APOSTROPHE}"};
 
-auto FullStopDelimited(str32 text) -> std::string {
+/// Revision of the output of the backends. This is part of the key of
+/// every entry in the output cache, so bump it whenever the same input
+/// produces different output.
+constexpr u32 OutputRevision = 2;
+
+/// Number of entries that each fork emits before it is joined if we’re
+/// streaming output into a sink.
+constexpr usz StreamedEntriesPerFork = 256;
+
+auto FullStopDelimited(str text) -> std::string {
     text.trim();
     if (text.empty()) return "";
-    auto str = text::ToUTF8(text);
+    auto s = text.string();
 
     // Skip past quotes so we don’t turn e.g. ⟨...’⟩ into ⟨...’.⟩.
-    while (text.ends_with_any(Apostrophe)) text.drop_back();
+    for (;;) {
+        auto it = rgs::find_if(Apostrophes, [&](str a) { return text.ends_with(a); });
+        if (it == std::end(Apostrophes)) break;
+        text.drop_back(it->size());
+    }
 
     // Recognise common punctuation marks.
-    if (not text.ends_with_any(U"?!.") and not text.ends_with(U"\\ldots")) str += ".";
-    return str;
+    if (not text.ends_with_any("?!.") and not text.ends_with("\\ldots")) s += ".";
+    return s;
+}
+
+/// Take everything up to the next '\\ex' or '\\comment', whichever comes first.
+auto TakeUntilCommentOrEx(str& text) -> str {
+    auto a = text, b = text;
+    auto ex = a.take_until("\\ex");
+    auto comment = b.take_until("\\comment");
+    return text.take(std::min(ex.size(), comment.size()));
+}
+
+/// Run 'worker' on 'threads' threads and wait for all of them to finish.
+template <typename Worker>
+void RunWorkers(usz threads, Worker worker) {
+    std::vector<std::jthread> workers;
+    workers.reserve(threads);
+    for (usz i = 0; i < threads; i++) workers.emplace_back(worker);
 }
 }
 
 void Entry::emit(Backend& backend) const { // clang-format off
     backend.line = line;
-    auto s = text::ToUTF8(word);
     data.visit(utils::Overloaded{
-        [&](const RefEntry& ref) { backend.emit(s, ref); },
-        [&](const FullEntry& f)  { backend.emit(s, f); },
+        [&](const RefEntry& ref) { backend.emit(word, ref); },
+        [&](const FullEntry& f)  { backend.emit(word, f); },
     });
 } // clang-format on
 
-void Generator::create_full_entry(std::u32string word, std::vector<std::u32string> parts) {
+Generator::Generator(std::span<Backend* const> backends, usz threads)
+    : backends(backends.begin(), backends.end()),
+      threads(std::max<usz>(threads, 1)),
+      backend_threads(this->threads) {
+    Assert(not this->backends.empty(), "Generator needs at least one backend");
+    for (auto b : this->backends) {
+        Assert(&b->ops == &ops(), "All backends must use the same language ops");
+        b->profiler = &profiler;
+    }
+}
+
+Generator::~Generator() {
+    for (auto b : backends) {
+        b->profiler = nullptr;
+        b->precomputed_ipa = nullptr;
+        b->ipa_cache = nullptr;
+    }
+}
+
+void Generator::create_full_entry(
+    LogicalLine& l,
+    text::Transliterator& transliterator,
+    std::string word,
+    std::vector<std::string> parts
+) {
     using enum FullEntry::Part;
     FullEntry entry;
 
-    if (not disallow_specials(word, "in the lemma"))
+    if (not disallow_specials(l, word, "in the lemma"))
         return;
 
     // Preprocessing.
-    if (auto res = ops().preprocess_full_entry(parts); not res) {
-        backend.error("Preprocessing error: {}", res.error());
+    Result<> preprocessed;
+    {
+        ProfileScope _{&profiler, Phase::Preprocess};
+        preprocessed = ops().preprocess_full_entry(parts);
+    }
+
+    if (not preprocessed) {
+        l.error("Preprocessing error: {}", preprocessed.error());
         return;
     }
 
     // Make sure we have enough parts.
     if (parts.size() < +MinParts) {
-        backend.error("An entry must have at least 4 parts: word, part of speech, etymology, definition");
+        l.error("An entry must have at least 4 parts: word, part of speech, etymology, definition");
         return;
     }
 
     // Make sure we don’t have too many parts.
     if (parts.size() > +MaxParts) {
-        backend.error("An entry must have at most 6 parts: word, part of speech, etymology, definition, forms, IPA");
+        l.error("An entry must have at most 6 parts: word, part of speech, etymology, definition, forms, IPA");
         return;
     }
 
@@ -63,10 +125,10 @@ void Generator::create_full_entry(std::u32string word, std::vector<std::u32strin
     static_assert(+MaxParts == 5, "Handle all parts below");
 
     // Part of speech.
-    entry.pos = text::ToUTF8(parts[+POSPart]);
+    entry.pos = std::move(parts[+POSPart]);
 
     // Etymology.
-    entry.etym = text::ToUTF8(parts[+EtymPart]);
+    entry.etym = std::move(parts[+EtymPart]);
 
     // Definition and senses.
     //
@@ -83,20 +145,19 @@ void Generator::create_full_entry(std::u32string word, std::vector<std::u32strin
     //          \comment comment for example 1
     //     \ex example 2
     //          \comment comment for example 2
-    auto SplitSense = [&](str32 sense) {
-        static constexpr str32 Ex = U"\\ex";
-        static constexpr str32 Comment = U"\\comment";
-        static auto CommentOrEx = u32regex::create(U"\\\\(?:ex|comment)").value();
+    auto SplitSense = [&](str sense) {
+        static constexpr str Ex = "\\ex";
+        static constexpr str Comment = "\\comment";
 
         // Find the sense comment or first example, if any, and depending on which comes first.
         FullEntry::Sense s;
-        auto def_text = sense.trim_front().take_until(CommentOrEx);
+        auto def_text = TakeUntilCommentOrEx(sense.trim_front());
         bool def_is_empty = def_text.trim().empty();
         s.def = FullStopDelimited(def_text);
 
         // Sense has a comment.
         if (sense.trim_front().consume(Comment)) {
-            if (def_is_empty) backend.error(
+            if (def_is_empty) l.error(
                 "\\comment is not allowed in an empty sense or empty primary definition. Use \\textit{{...}} instead."
             );
 
@@ -105,19 +166,19 @@ void Generator::create_full_entry(std::u32string word, std::vector<std::u32strin
 
         // At this point, we should either be at the end or at an example.
         while (sense.trim_front().consume(Ex)) {
-            if (def_is_empty) backend.error(
+            if (def_is_empty) l.error(
                 "\\ex is not allowed in an empty sense or empty primary definition."
             );
 
             auto& ex = s.examples.emplace_back();
-            ex.text = FullStopDelimited(sense.trim_front().take_until(CommentOrEx));
+            ex.text = FullStopDelimited(TakeUntilCommentOrEx(sense.trim_front()));
             if (sense.consume(Comment))
                 ex.comment = FullStopDelimited(sense.trim_front().take_until(Ex));
         }
 
         // Two comments are invalid.
         if (sense.trim_front().starts_with(Comment))
-            backend.error("Unexpected \\comment token");
+            l.error("Unexpected \\comment token");
 
         return s;
     };
@@ -126,161 +187,509 @@ void Generator::create_full_entry(std::u32string word, std::vector<std::u32strin
     // and doesn’t count as a sense because it is either the only one or, if there
     // are multiple senses, it denotes a more overarching definition that applies
     // to all or most senses.
-    str32 s{parts[+DefPart]};
-    entry.primary_definition = SplitSense(s.take_until_and_drop(SenseMacroU32));
-    for (auto sense : s.split(SenseMacroU32))
-        entry.senses.push_back(SplitSense(sense));
+    {
+        ProfileScope _{&profiler, Phase::SplitSenses};
+        str s{parts[+DefPart]};
+        entry.primary_definition = SplitSense(s.take_until_and_drop(SenseMacro));
+        for (auto sense : s.split(SenseMacro))
+            entry.senses.push_back(SplitSense(sense));
+    }
 
     // Forms.
     //
     // FIXME: The dot should be added here instead of by LaTeX.
-    if (parts.size() > +FormsPart) entry.forms = text::ToUTF8(parts[+FormsPart]);
+    if (parts.size() > +FormsPart) entry.forms = std::move(parts[+FormsPart]);
 
     // IPA.
-    if (parts.size() > +IPAPart) entry.ipa = text::ToUTF8(parts[+IPAPart]);
+    if (parts.size() > +IPAPart) entry.ipa = std::move(parts[+IPAPart]);
+    add_entry(l, transliterator, std::move(word), std::move(entry));
+}
 
-    // Create a canonicalised form of this entry for sorting.
-    auto nfkd = transliterator(word);
-    entries.emplace_back(std::move(word), backend.line, std::move(nfkd), std::move(entry));
+void Generator::add_entry(
+    LogicalLine& l,
+    text::Transliterator& transliterator,
+    std::string word,
+    Variant<RefEntry, FullEntry> data
+) {
+    // Create a canonicalised form of this entry for sorting; this is
+    // the only place where we need the headword in UTF-32.
+    auto word32 = text::ToUTF32(word);
+    auto nfkd = transliterator(word32);
+    auto key = ops().sort_key(word32, nfkd);
+    auto& e = l.entries.emplace_back(std::move(word), l.line, std::move(nfkd), std::move(data), l.hash, std::move(key), l.tag);
+
+    // Without a sort key, we need this to collate the entry later.
+    if (not e.sort_key) e.word32 = std::move(word32);
 }
 
-bool Generator::disallow_specials(str32 text, str message) {
-    auto Disallow = [&](str32 what) {
+bool Generator::disallow_specials(LogicalLine& l, str text, str message) {
+    auto Disallow = [&](str what) {
         if (text.contains(what)) {
-            backend.error("'{}' cannot be used {}", what, message);
+            l.error("'{}' cannot be used {}", what, message);
             return false;
         }
 
         return true;
     };
 
-    return Disallow(U"\\ex") and Disallow(U"\\comment") and Disallow(U"\\\\");
+    return Disallow("\\ex") and Disallow("\\comment") and Disallow("\\\\");
 }
 
-auto Generator::emit_to_string() -> EmitResult {
-    // Sort the entries.
-    rgs::stable_sort(entries, [&](const auto& a, const auto& b) {
-        return ops().collate(a.word, b.word, a.nfkd, b.nfkd);
+auto Generator::emit_all(std::span<OutputSink* const> sinks) -> std::vector<EmitResult> {
+    Assert(sinks.empty() or sinks.size() == backends.size(), "Need one sink per backend");
+    sort_entries();
+
+    std::vector<EmitResult> results(backends.size());
+    auto Emit = [&](usz i, bool ipa_precomputed = false) {
+        results[i] = emit_backend(*backends[i], sinks.empty() ? nullptr : sinks[i], ipa_precomputed);
+    };
+
+    if (threads == 1 or backends.size() < 2) {
+        for (usz i = 0; i < backends.size(); i++) Emit(i);
+        return results;
+    }
+
+    // The output cache is not thread-safe, so emit into the backends that
+    // use it first, one after another.
+    auto UsesCache = [&](usz i) { return cache and not backends[i]->cache_tag().empty(); };
+    for (usz i = 0; i < backends.size(); i++)
+        if (UsesCache(i)) Emit(i);
+
+    // Convert the IPA for every other backend up front; this way, the
+    // table isn’t modified anymore once we start emitting concurrently.
+    for (usz i = 0; i < backends.size(); i++)
+        if (not UsesCache(i)) precompute_ipa(*backends[i], pending_entries(*backends[i]));
+
+    // Emit into the rest concurrently. Split the threads between them so
+    // we don’t use more than 'threads' threads in total; if there are more
+    // backends than threads, some threads emit into several backends.
+    std::vector<usz> concurrent;
+    for (usz i = 0; i < backends.size(); i++)
+        if (not UsesCache(i)) concurrent.push_back(i);
+
+    if (concurrent.empty()) return results;
+    auto workers = std::min(threads, concurrent.size());
+    backend_threads = threads / workers;
+    defer { backend_threads = threads; };
+
+    std::atomic<usz> next = 0;
+    RunWorkers(workers, [&] {
+        for (usz i; (i = next.fetch_add(1, std::memory_order_relaxed)) < concurrent.size();)
+            Emit(concurrent[i], true);
     });
 
-    // Emit each entry.
-    for (auto& entry : entries) entry.emit(backend);
-    backend.finish();
-    return {backend.output, backend.has_error};
+    return results;
+}
+
+auto Generator::emit_backend(Backend& b, OutputSink* sink, bool ipa_precomputed) -> EmitResult {
+    {
+        ProfileScope _{&profiler, Phase::Emit};
+        if (cache and not b.cache_tag().empty()) {
+            emit_cached(b, sink);
+        } else {
+            if (not ipa_precomputed) precompute_ipa(b, pending_entries(b));
+            emit_entries(b, sink);
+        }
+        b.finish();
+    }
+
+    EmitResult res{std::move(b.output), b.has_error, profiler.snapshot()};
+    b.output.clear();
+    if (not sink) return res;
+
+    // Write anything that the backend held on to until the end. If there
+    // were errors, and we’ve already written entries to the sink, write
+    // the errors too so the output doesn’t look complete.
+    if (not res.has_error) {
+        sink->write(res.backend_output);
+        res.backend_output.clear();
+    } else if (b.streams_output()) {
+        sink->write(res.backend_output);
+    }
+
+    auto flushed = sink->flush();
+    if (not flushed.has_value() and not res.has_error) {
+        res.has_error = true;
+        res.backend_output = std::format("{}", flushed.error());
+    }
+
+    return res;
+}
+
+auto Generator::emit_to_string() -> EmitResult {
+    Assert(backends.size() == 1, "Use emit_all() to emit into multiple backends");
+    sort_entries();
+    return emit_backend(*backends.front(), nullptr);
+}
+
+auto Generator::emit_to(OutputSink& s) -> EmitResult {
+    Assert(backends.size() == 1, "Use emit_all() to emit into multiple backends");
+    sort_entries();
+    return emit_backend(*backends.front(), &s);
+}
+
+void Generator::sort_entries() {
+    ProfileScope _{&profiler, Phase::Sort};
+
+    // Prefer sort keys if we have them since comparing those is a lot
+    // cheaper than calling into the language ops.
+    if (rgs::all_of(entries, [](const Entry& e) { return e.sort_key.has_value(); })) {
+        rgs::stable_sort(entries, [](const Entry& a, const Entry& b) {
+            return *a.sort_key < *b.sort_key;
+        });
+    } else {
+        for (auto& e : entries)
+            if (e.sort_key) e.word32 = text::ToUTF32(e.word);
+        rgs::stable_sort(entries, [&](const Entry& a, const Entry& b) {
+            return ops().collate(a.word32, b.word32, a.nfkd, b.nfkd);
+        });
+    }
+}
+
+void Generator::emit_cached(Backend& b, OutputSink* sink) {
+    // Look up every entry in the cache.
+    auto pending = pending_entries(b);
+    auto tag = HashBytes(std::format("{}\x1f{}\x1f{}", OutputRevision, b.cache_tag(), ops().version_tag()));
+    std::vector<u64> keys(entries.size());
+    std::vector<const std::string*> cached(entries.size());
+    std::vector<usz> misses;
+    for (auto i : pending) {
+        keys[i] = HashBytes(entries[i].word, tag ^ entries[i].source_hash);
+        cached[i] = cache->find(keys[i]);
+        if (not cached[i]) misses.push_back(i);
+    }
+
+    // Emit the entries that weren’t in the cache. If the backend can’t be
+    // forked, emit everything into it directly instead.
+    auto forks = fork_backend(b, std::clamp<usz>(misses.size(), 1, backend_threads));
+    if (forks.empty()) {
+        precompute_ipa(b, pending);
+        return emit_entries(b, sink);
+    }
+
+    precompute_ipa(b, misses);
+    std::vector<std::optional<std::string>> fragments(entries.size());
+    std::atomic<usz> next_fork = 0, next_miss = 0;
+    auto EmitMisses = [&] {
+        auto& fork = *forks[next_fork.fetch_add(1, std::memory_order_relaxed)];
+        for (usz i; (i = next_miss.fetch_add(1, std::memory_order_relaxed)) < misses.size();) {
+            entries[misses[i]].emit(fork);
+            fragments[misses[i]] = fork.take_fragment();
+        }
+    };
+
+    if (forks.size() == 1 or misses.size() < 2) EmitMisses();
+    else RunWorkers(forks.size(), EmitMisses);
+
+    // Splice everything together in order. Entries that had errors are
+    // not cached; emit them again so the errors are reported in order.
+    for (auto i : pending) {
+        if (cached[i]) {
+            b.splice(*cached[i]);
+        } else if (fragments[i]) {
+            b.splice(*fragments[i]);
+            cache->insert(keys[i], std::move(*fragments[i]));
+        } else {
+            entries[i].emit(*forks.front());
+            b.join(*forks.front());
+        }
+
+        flush_output(b, sink);
+    }
+}
+
+void Generator::emit_entries(Backend& b, OutputSink* sink) {
+    auto pending = pending_entries(b);
+
+    // If we’re allowed to use multiple threads, each thread emits a
+    // contiguous range of entries into a fork of the backend, and the
+    // forks are joined in order afterwards.
+    //
+    // If we’re streaming into a sink, do this in chunks so the forks never
+    // hold on to more than a chunk’s worth of output at a time.
+    auto forks = backend_threads == 1 or pending.size() < 2
+                   ? std::vector<std::unique_ptr<Backend>>{}
+                   : fork_backend(b, std::min(backend_threads, pending.size()));
+
+    if (forks.empty()) {
+        for (auto i : pending) {
+            entries[i].emit(b);
+            flush_output(b, sink);
+        }
+        return;
+    }
+
+    auto chunk_size = sink and b.streams_output() ? forks.size() * StreamedEntriesPerFork : pending.size();
+    for (usz start = 0; start < pending.size(); start += chunk_size) {
+        auto chunk = std::span{pending}.subspan(start, std::min(chunk_size, pending.size() - start));
+        std::atomic<usz> next = 0;
+        RunWorkers(forks.size(), [&] {
+            auto i = next.fetch_add(1, std::memory_order_relaxed);
+            auto begin = i * chunk.size() / forks.size();
+            auto end = (i + 1) * chunk.size() / forks.size();
+            for (auto e : chunk.subspan(begin, end - begin)) entries[e].emit(*forks[i]);
+        });
+
+        for (auto& f : forks) {
+            b.join(*f);
+            flush_output(b, sink);
+        }
+    }
+}
+
+void Generator::flush_output(Backend& b, OutputSink* sink) {
+    if (not sink or not b.streams_output() or b.output.empty()) return;
+    sink->write(b.output);
+    b.output.clear();
+}
+
+auto Generator::fork_backend(Backend& b, usz count) -> std::vector<std::unique_ptr<Backend>> {
+    std::vector<std::unique_ptr<Backend>> forks;
+    for (usz i = 0; i < count; i++) {
+        auto f = b.fork();
+        if (not f) return {};
+        f->profiler = b.profiler;
+        f->ipa_cache = b.ipa_cache;
+        f->precomputed_ipa = b.precomputed_ipa;
+        forks.push_back(std::move(f));
+    }
+    return forks;
+}
+
+auto Generator::pending_entries(const Backend& b) const -> std::vector<usz> {
+    std::vector<usz> pending;
+    pending.reserve(entries.size());
+    for (auto [i, e] : utils::enumerate(entries))
+        if (b.accepts(e.tag)) pending.push_back(usz(i));
+    return pending;
 }
 
 int Generator::emit() {
-    auto [output, has_error] = emit_to_string();
-    if (has_error) {
-        std::println(stderr, "{}", output);
+    auto out = FileSink::Stdout();
+    auto res = emit_to(out);
+    if (res.has_error) {
+        std::println(stderr, "{}", res.backend_output);
+        return 1;
+    }
+
+    out.write("\n");
+    if (auto flushed = out.flush(); not flushed.has_value()) {
+        std::println(stderr, "{}", flushed.error());
         return 1;
     }
 
-    std::println("{}", output);
     return 0;
 }
 
 void Generator::parse(str input_text) {
-    static constexpr str32 ws = U" \t\v\f\n\r";
+    ProfileScope _{&profiler, Phase::Parse};
+    auto lines = split_lines(input_text);
+
+    // Build the entries for each line. This is the expensive part, so
+    // distribute it across multiple threads if we’re allowed to.
+    std::atomic<usz> next = 0;
+    auto ParseLines = [&](text::Transliterator& t) {
+        for (usz i; (i = next.fetch_add(1, std::memory_order_relaxed)) < lines.size();)
+            parse_line(lines[i], t);
+    };
 
-    // Convert text to u32.
-    std::u32string text = text::ToUTF32(input_text);
+    if (threads == 1 or lines.size() < 2) ParseLines(*TransliteratorRegistry::Acquire(SortRules));
+    else RunWorkers(std::min(threads, lines.size()), [&] {
+        // ICU transliterators are not thread-safe, so each worker needs its own.
+        auto t = TransliteratorRegistry::Acquire(SortRules);
+        ParseLines(*t);
+    });
 
-    // Convert a line into an entry.
-    std::u32string logical_line;
-    auto ShipOutLine = [&] {
-        if (logical_line.empty()) return;
-        defer { logical_line.clear(); };
-        logical_line = str32(logical_line).fold_ws();
-        str32 line{logical_line};
-        line.trim();
-
-        // If the line contains no '|' characters and a `>`,
-        // it is a reference. Split by '>'. The lhs is a
-        // comma-separated list of references, the rhs is the
-        // actual definition.
-        if (not line.contains(U'|')) {
-            if (not line.contains(U'>')) {
-                backend.error("An entry must contain at least one '|' or '>'");
-                return;
-            }
+    // Report diagnostics to every backend that the line is for, and
+    // collect the entries in input order.
+    for (auto& l : lines) {
+        for (auto b : backends) {
+            if (not b->accepts(l.tag)) continue;
+            b->line = l.line;
+            for (auto& e : l.errors) b->error("{}", e);
+        }
 
-            if (not disallow_specials(line, "in a reference entry"))
-                return;
-
-            auto from = line.take_until(U'>').trim();
-            auto target = line.drop().trim();
-            for (auto entry : from.split(U",")) {
-                auto word = entry.trim();
-                entries.emplace_back(
-                    std::u32string{word},
-                    backend.line,
-                    transliterator(word),
-                    RefEntry{text::ToUTF8(target)}
-                );
-            }
+        for (auto& e : l.entries) entries.push_back(std::move(e));
+    }
+}
+
+auto Generator::parse_file(const std::filesystem::path& path) -> Result<> {
+    auto file = Try(MappedFile::Open(path));
+    parse(file.contents());
+    return {};
+}
+
+void Generator::precompute_ipa(Backend& b, std::span<const usz> pending) {
+    b.precomputed_ipa = &ipa;
+
+    // Collect every word that the backend is going to convert, except
+    // for those that we’ve already converted or that are in the cache;
+    // if there are none, this doesn’t modify anything, so other backends
+    // can still read the table at the same time.
+    std::vector<std::string> words;
+    std::unordered_set<std::string> seen;
+    for (auto i : pending) {
+        auto& e = entries[i];
+        auto Add = [&](const FullEntry& f) {
+            auto source = b.ipa_source(e.word, f);
+            if (not source or ipa.contains(*source) or not seen.insert(*source).second) return;
+            if (b.ipa_cache and b.ipa_cache->find(*source)) return;
+            words.push_back(std::move(*source));
+        };
+
+        e.data.visit(utils::Overloaded{[](const RefEntry&) {}, Add});
+    }
+
+    if (words.empty()) return;
+
+    // Convert them in batches; use one batch per thread so languages that
+    // don’t override 'to_ipa_batch()' still get parallelised.
+    std::vector<str> views(words.begin(), words.end());
+    std::vector<std::vector<Result<std::string>>> batches(std::min(threads, words.size()));
+    std::atomic<usz> next = 0;
+    auto ConvertBatch = [&] {
+        auto i = next.fetch_add(1, std::memory_order_relaxed);
+        auto begin = i * words.size() / batches.size();
+        auto end = (i + 1) * words.size() / batches.size();
+        ProfileScope _{&profiler, Phase::ToIPA};
+        batches[i] = ops().to_ipa_batch(std::span{views}.subspan(begin, end - begin));
+        Assert(batches[i].size() == end - begin, "to_ipa_batch() must return one result per word");
+    };
+
+    if (batches.size() == 1) ConvertBatch();
+    else RunWorkers(batches.size(), ConvertBatch);
+
+    // Save the results; add them to the cache here so we don’t have to
+    // do that on every thread during emission.
+    usz word = 0;
+    for (auto& batch : batches) {
+        for (auto& res : batch) {
+            if (b.ipa_cache and res.has_value()) b.ipa_cache->insert(words[word], res.value());
+            ipa.emplace(std::move(words[word++]), std::move(res));
+        }
+    }
+}
+
+void Generator::parse_line(LogicalLine& l, text::Transliterator& transliterator) {
+    auto line = l.text();
+    if (line.empty()) return;
+
+    // Only copy the line if we actually need to fold whitespace.
+    if (line.contains_any("\t\n\v\f\r") or line.contains("  ")) {
+        l.owned = line.fold_ws();
+        line = l.owned;
+    }
+
+    l.hash = HashBytes({line.data(), line.size()});
+    line.trim();
+
+    // If the line contains no '|' characters and a `>`,
+    // it is a reference. Split by '>'. The lhs is a
+    // comma-separated list of references, the rhs is the
+    // actual definition.
+    if (not line.contains('|')) {
+        if (not line.contains('>')) {
+            l.error("An entry must contain at least one '|' or '>'");
+            return;
         }
 
-        // Otherwise, the line is an entry. Split by '|' and emit
-        // a single entry for the line.
-        else {
-            bool first = true;
-            std::u32string word;
-            std::vector<std::u32string> line_parts;
-            for (auto part : line.split(U"|")) {
-                if (first) {
-                    first = false;
-                    word = std::u32string{part.trim()};
-                } else {
-                    line_parts.emplace_back(part.trim());
-                }
+        if (not disallow_specials(l, line, "in a reference entry"))
+            return;
+
+        auto from = line.take_until('>').trim();
+        auto target = line.drop().trim();
+        for (auto entry : from.split(","))
+            add_entry(l, transliterator, entry.trim().string(), RefEntry{target.string()});
+    }
+
+    // Otherwise, the line is an entry. Split by '|' and emit
+    // a single entry for the line.
+    else {
+        bool first = true;
+        std::string word;
+        std::vector<std::string> line_parts;
+        for (auto part : line.split("|")) {
+            if (first) {
+                first = false;
+                word = part.trim().string();
+            } else {
+                line_parts.push_back(part.trim().string());
             }
-            create_full_entry(std::move(word), std::move(line_parts));
         }
+        create_full_entry(l, transliterator, std::move(word), std::move(line_parts));
+    }
+}
+
+auto Generator::split_lines(str input_text) -> std::vector<LogicalLine> {
+    std::vector<LogicalLine> lines;
+
+    // Ship out the current logical line. Note that the line number we
+    // attribute it to is that of the line we’re currently on.
+    //
+    // Logical lines that consist of a single line refer to the input;
+    // we only need to copy them if they’re continued.
+    str logical_line;
+    std::string continued_line;
+    bool continued = false;
+    i64 line_number = 1;
+    BackendTag tag = BackendTag::All;
+    bool accepted = true;
+    auto ShipOutLine = [&] {
+        // Drop lines that none of our backends want; there is no point
+        // in parsing and sorting entries that are never emitted.
+        if (not accepted) {}
+        else if (continued) lines.emplace_back(line_number, str{}, std::move(continued_line)).tag = tag;
+        else if (not logical_line.empty()) lines.emplace_back(line_number, logical_line).tag = tag;
+        logical_line = {};
+        continued_line.clear();
+        continued = false;
+    };
+
+    // Record an error that is not part of any logical line.
+    auto DirectiveError = [&]<typename... Args>(std::format_string<Args...> fmt, Args&&... args) {
+        lines.emplace_back(line_number).error(fmt, LIBBASE_FWD(args)...);
     };
 
     // Process the text.
-    bool skipping = false;
-    for (auto [i, line] : utils::enumerate(str32(text).lines())) {
-        line = line.take_until(U'#');
-        backend.line = i + 1;
+    for (auto [i, line] : utils::enumerate(input_text.lines())) {
+        line = line.take_until('#');
+        line_number = i64(i + 1);
 
         // Skip empty lines.
         if (line.empty()) continue;
 
         // Check for directives.
-        if (line.starts_with(U'$')) {
+        if (line.starts_with('$')) {
             ShipOutLine(); // Lines can’t span directives.
-            if (line.consume(U"$backend")) {
+            if (line.consume("$backend")) {
                 line.trim_front();
-                if (line.consume(U"all")) skipping = false;
-                else if (line.consume(U"json")) skipping = not dynamic_cast<JsonBackend*>(&backend);
-                else if (line.consume(U"tex")) skipping = not dynamic_cast<TeXBackend*>(&backend);
-                else backend.error("Unknown backend: {}", line);
+                if (line.consume("all")) tag = BackendTag::All;
+                else if (line.consume("json")) tag = BackendTag::Json;
+                else if (line.consume("tex")) tag = BackendTag::TeX;
+                else DirectiveError("Unknown backend: {}", line);
+                accepted = rgs::any_of(backends, [&](Backend* b) { return b->accepts(tag); });
                 continue;
             }
 
-            backend.error("Unknown directive: {}", line);
+            DirectiveError("Unknown directive: {}", line);
             continue;
         }
 
-        // Skip lines that are not for this backend.
-        if (skipping) continue;
-
         // Perform line continuation.
-        if (line.starts_with_any(U" \t")) {
-            logical_line += ' ';
-            logical_line += line.trim();
+        if (line.starts_with_any(" \t")) {
+            if (not std::exchange(continued, true)) continued_line = logical_line.string();
+            continued_line += ' ';
+            continued_line += line.trim();
             continue;
         }
 
         // This line starts a new entry, so ship out the last
         // one and start a new one.
         ShipOutLine();
-        logical_line = line.string();
+        logical_line = line;
     }
 
     // Ship out the last line.
     ShipOutLine();
+    return lines;
 }
-
@@ -1,45 +1,190 @@
 #include <dictgen/backends.hh>
+#include <dictgen/scan.hh>
 #include <base/Text.hh>
+#include <cstring>
+#include <fstream>
 #include <print>
 #include <set>
 
 using namespace dict;
 
-JsonBackend::JsonBackend(LanguageOps& ops, bool minify)
+/// Check whether a string consists only of ASCII characters.
+static auto IsAscii(str s) -> bool {
+    // Check 8 bytes at a time; the compiler can vectorise this further.
+    static constexpr u64 HighBits = 0x8080'8080'8080'8080;
+    u64 acc = 0;
+    usz i = 0;
+    for (; i + sizeof(u64) <= s.size(); i += sizeof(u64)) {
+        u64 chunk;
+        std::memcpy(&chunk, s.data() + i, sizeof(u64));
+        acc |= chunk;
+    }
+
+    for (; i < s.size(); i++) acc |= u8(s[i]);
+    return (acc & HighBits) == 0;
+}
+
+/// Record that the entry or reference at 'index' contains every token
+/// in 'tokens', which is a space-separated list of unique words.
+static void AddPostings(JsonBackend::SearchIndex::Postings& postings, str tokens, usz index) {
+    for (auto token : tokens.split(" ")) {
+        if (token.empty()) continue;
+        auto it = postings.find(std::string_view{token.data(), token.size()});
+        if (it == postings.end()) it = postings.emplace(token.string(), std::vector<u32>{}).first;
+        it->second.push_back(u32(index));
+    }
+}
+
+/// Move the postings from a fork into 'into', offsetting the indices by
+/// the number of elements that precede the fork’s.
+static void MergePostings(
+    JsonBackend::SearchIndex::Postings& into,
+    JsonBackend::SearchIndex::Postings& from,
+    usz offset
+) {
+    for (auto& [token, indices] : from) {
+        auto& list = into[token];
+        for (auto i : indices) list.push_back(u32(i + offset));
+    }
+    from.clear();
+}
+
+/// Get all tokens in a set of postings as a space-separated list.
+static auto Tokens(JsonBackend::SearchIndex::Postings& postings) -> std::string {
+    return utils::join(postings | vws::keys, " ");
+}
+
+/// Write a string as a JSON string literal, escaping it the same
+/// way 'json::dump()' does.
+static void WriteJsonString(std::string& out, str s) {
+    static constexpr str Hex = "0123456789abcdef";
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (u8(c) >= 0x20) {
+                    out += c;
+                } else {
+                    out += "\\u00";
+                    out += Hex[u8(c) >> 4];
+                    out += Hex[u8(c) & 0xF];
+                }
+        }
+    }
+    out += '"';
+}
+
+auto JsonWriter::begin_array() -> JsonWriter& {
+    Open('[');
+    return *this;
+}
+
+auto JsonWriter::begin_object() -> JsonWriter& {
+    Open('{');
+    return *this;
+}
+
+auto JsonWriter::element() -> JsonWriter& {
+    Separate();
+    return *this;
+}
+
+auto JsonWriter::end_array() -> JsonWriter& {
+    Close(']');
+    return *this;
+}
+
+auto JsonWriter::end_object() -> JsonWriter& {
+    Close('}');
+    return *this;
+}
+
+auto JsonWriter::key(str k) -> JsonWriter& {
+    Separate();
+    WriteJsonString(out, k);
+    out += minify ? ":" : ": ";
+    return *this;
+}
+
+void JsonWriter::newline() {
+    if (minify) return;
+    out += '\n';
+    out.append(usz(depth) * 4, ' ');
+}
+
+auto JsonWriter::number(u64 n) -> JsonWriter& {
+    std::format_to(std::back_inserter(out), "{}", n);
+    return *this;
+}
+
+auto JsonWriter::string(str s) -> JsonWriter& {
+    WriteJsonString(out, s);
+    return *this;
+}
+
+void JsonWriter::Close(char c) {
+    depth--;
+    if (not first) newline();
+    first = open_containers.back();
+    open_containers.pop_back();
+    out += c;
+}
+
+void JsonWriter::Open(char c) {
+    out += c;
+    open_containers.push_back(first);
+    first = true;
+    depth++;
+}
+
+void JsonWriter::Separate() {
+    if (not first) out += ',';
+    first = false;
+    newline();
+}
+
+JsonBackend::JsonBackend(LanguageOps& ops, bool minify, bool search_index)
+    : JsonBackend(ops, minify, search_index, true) {}
+
+JsonBackend::JsonBackend(LanguageOps& ops, bool minify, bool search_index, bool write_header)
     : Backend{ops}, minify{minify} {
-    out = json::object();
-    refs() = json::array();
-    entries() = json::array();
-    html_escaper.add("<", "&lt;");
-    html_escaper.add(">", "&gt;");
-    html_escaper.add("§~", "grammar"); // FIXME: Make section references work somehow.
-    html_escaper.add("~", "&nbsp;");
-    html_escaper.add("&", "&amp;");
+    if (search_index) this->search_index = std::make_unique<SearchIndex>();
+
+    // Entries are written to the output as they are emitted; forks
+    // only contain entries, so they don’t get a header.
+    if (write_header) OpenDocument(output);
 }
 
-struct JsonBackend::Renderer : dict::Renderer {
+template <bool StripFormatting>
+struct JsonBackend::Renderer final : dict::Renderer<Renderer<StripFormatting>> {
     JsonBackend& backend;
-    const bool raw_text;
-    Renderer(JsonBackend& backend, bool strip_formatting)
-        : backend{backend}, raw_text{strip_formatting} {}
+    explicit Renderer(JsonBackend& backend) : backend{backend} {}
 
-    void render_macro(const MacroNode& n) override;
+    bool begin_macro(Macro m) override;
+    void end_macro(Macro m) override;
     void render_text(str text) override;
     void render_formatting(str formatting) override;
-    auto tag_name(Macro m) -> str;
+    static auto tag_name(Macro m) -> str;
 };
 
-void JsonBackend::Renderer::render_macro(const MacroNode& n) {
-    if (raw_text) return;
-    if (auto s = tag_name(n.macro); not s.empty()) {
+template <bool StripFormatting>
+bool JsonBackend::Renderer<StripFormatting>::begin_macro(Macro m) {
+    if constexpr (StripFormatting) return false;
+    auto& out = this->out;
+    if (auto s = tag_name(m); not s.empty()) {
         out += std::format("<{}>", s);
-        render(n.args);
-        out += std::format("</{}>", s);
-        return;
+        return true;
     }
 
-    switch (n.macro) {
-        default: Unreachable("Unsupported macro '{}'", +n.macro);
+    switch (m) {
+        default: Unreachable("Unsupported macro '{}'", +m);
         case Macro::Ellipsis: out += "&hellip;"; break;
         case Macro::ParagraphBreak: out += "</p><p>"; break;
         case Macro::SoftHyphen: out += "&shy;"; break;
@@ -48,19 +193,29 @@ void JsonBackend::Renderer::render_macro(const MacroNode& n) {
             out += std::format("<f-w>{}</f-w>", backend.current_word);
             break;
     }
+
+    return false;
 }
 
-void JsonBackend::Renderer::render_text(str text) {
-    if (not raw_text and text.contains_any("<>§~-&")) out += backend.html_escaper.replace(text);
-    else out += text;
+template <bool StripFormatting>
+void JsonBackend::Renderer<StripFormatting>::end_macro(Macro m) {
+    this->out += std::format("</{}>", tag_name(m));
 }
 
-void JsonBackend::Renderer::render_formatting(str formatting) {
-    if (raw_text) return;
-    out += formatting;
+template <bool StripFormatting>
+void JsonBackend::Renderer<StripFormatting>::render_text(str text) {
+    if constexpr (StripFormatting) this->out += text;
+    else EscapeHtml(this->out, text);
 }
 
-auto JsonBackend::Renderer::tag_name(Macro m) -> str {
+template <bool StripFormatting>
+void JsonBackend::Renderer<StripFormatting>::render_formatting(str formatting) {
+    if constexpr (StripFormatting) return;
+    this->out += formatting;
+}
+
+template <bool StripFormatting>
+auto JsonBackend::Renderer<StripFormatting>::tag_name(Macro m) -> str {
     switch (m) {
         case Macro::Bold: return "strong";
         case Macro::Italic: return "em";
@@ -82,17 +237,123 @@ auto JsonBackend::Renderer::tag_name(Macro m) -> str {
     Unreachable("Invalid macro");
 }
 
+// Copy runs of text that don’t need to be escaped in one go.
+void JsonBackend::EscapeHtml(std::string& out, str text) {
+    auto find = scan::Best().find_html_escape;
+    auto data = text.data();
+    auto size = text.size();
+    usz start = 0;
+    for (usz i = find(data, size); i != size; i = start + find(data + start, size - start)) {
+        std::string_view replacement;
+        usz end = i;
+        switch (data[i]) {
+            default: Unreachable();
+            case '<': replacement = "&lt;"; break;
+            case '>': replacement = "&gt;"; break;
+            case '&': replacement = "&amp;"; break;
+            case '~':
+                // None of the characters we escape are part of a '§', so if
+                // there is one before this, it’s still in the current run.
+                if (i - start >= 2 and data[i - 2] == '\xC2' and data[i - 1] == '\xA7') {
+                    end -= 2;
+                    replacement = "grammar"; // FIXME: Make section references work somehow.
+                } else {
+                    replacement = "&nbsp;";
+                }
+                break;
+        }
+
+        out.append(data + start, end - start);
+        out += replacement;
+        start = i + 1;
+    }
+
+    out.append(data + start, size - start);
+}
+
 // IMPORTANT: Remember to update the function with the same name in the
 // code for the ULTRAFRENCH dictionary page on nguh.org if the output of
 // this function changes.
 auto JsonBackend::NormaliseForSearch(str value) -> std::string {
-    auto haystack = search_transliterator(value);
+    ProfileScope _{profiler, Phase::NormaliseForSearch};
+    if (IsAscii(value)) return NormaliseAsciiForSearch(value);
+    return NormaliseForSearchGeneric(value);
+}
+
+auto JsonBackend::NormaliseForSearchGeneric(str value) -> std::string {
+    if (not search_transliterator) search_transliterator = TransliteratorRegistry::Acquire(SearchRules);
+    return PostprocessSearchHaystack((**search_transliterator)(value));
+}
+
+// This must produce the same output as running ASCII text through the
+// transliterator and PostprocessSearchHaystack(). For ASCII, the
+// transliterator only removes everything but letters and spaces and
+// lowercases the letters, so we do that and split the result into words
+// in a single pass.
+auto JsonBackend::NormaliseAsciiForSearch(str value) -> std::string {
+    // Words are written to a buffer that is large enough to hold the entire
+    // input so we can keep pointers into it. Every word is followed by a
+    // space, so if the input only consists of letters and single spaces,
+    // we need one more byte than the input for the space after the last
+    // word.
+    search_buffer.clear();
+    search_buffer.reserve(value.size() + 1);
+    search_words.clear();
+    usz word_start = 0;
+    bool weird = false;
+    auto EndWord = [&] {
+        if (word_start == search_buffer.size()) return;
+        std::string_view w{search_buffer.data() + word_start, search_buffer.size() - word_start};
+        weird = weird or w.contains("sbdsth");
+        search_words.push_back(w);
+        search_buffer += ' ';
+        word_start = search_buffer.size();
+    };
+
+    for (char c : value) {
+        auto lower = char(c | 0x20);
+        if (lower >= 'a' and lower <= 'z') search_buffer += lower;
+        else if (c == ' ') EndWord();
+    }
+
+    EndWord();
+
+    // 'sbdsth' removal can merge or split words in ways that depend on the
+    // surrounding whitespace; that’s rare, so just do what the slow path does.
+    if (weird) return PostprocessSearchHaystack(str(search_buffer).trim());
+
+    // Unique all words and sort them.
+    utils::unique_sort(search_words);
+    std::string out;
+    out.reserve(search_buffer.size());
+    for (auto w : search_words) {
+        if (not out.empty()) out += ' ';
+        out += w;
+    }
+
+    return out;
+}
 
+// The initial of a headword is the first letter of its first word that
+// survives search normalisation, so e.g. '(s)he' and 'She' end up in the
+// same shard.
+auto JsonBackend::Initial(str stripped_word) -> std::string {
+    for (auto w : stripped_word.split(" ")) {
+        auto normalised = NormaliseForSearch(w);
+        if (normalised.empty()) continue;
+        usz len = 1;
+        while (len < normalised.size() and (u8(normalised[len]) & 0xC0) == 0x80) len++;
+        return normalised.substr(0, len);
+    }
+    return "_";
+}
+
+auto JsonBackend::PostprocessSearchHaystack(str haystack) -> std::string {
     // The steps below only apply to the haystack, not the needle, and should
     // NOT be applied on the frontend:
     //
     // Yeet all instances of 'sbdsth', which is what 'sbd./sth.' degenerates to.
-    auto remove_weird = str(haystack).trim().replace("sbdsth", "");
+    auto remove_weird = haystack.trim().replace("sbdsth", "");
 
     // Trim and fold whitespace.
     auto fold_ws = str(remove_weird).fold_ws();
@@ -103,55 +364,127 @@ auto JsonBackend::NormaliseForSearch(str value) -> std::string {
     return utils::join(words, " ");
 }
 
-void JsonBackend::emit(str word, const FullEntry& data) {
-    json& e = entries().emplace_back();
-    e["word"] = current_word = tex_to_html(word);
-    e["pos"] = tex_to_html(data.pos);
-    e["ipa"] = Normalise([&] -> std::string {
+auto JsonBackend::ConvertEntry(str word, const FullEntry& data) -> HtmlEntry {
+    // Convert everything in the same order as we always have, so any
+    // errors are reported in a consistent order.
+    HtmlEntry e;
+    std::tie(e.word, e.stripped_word) = tex_to_html_and_text(word);
+    current_word = e.word;
+    e.pos = tex_to_html(data.pos);
+    e.ipa = Normalise([&] -> std::string {
         // If the user provided IPA, use it.
         if (not data.ipa.empty()) return data.ipa;
 
         // Otherwise, call the conversion function.
-        auto ipa = ops.to_ipa(word);
+        auto ipa = to_ipa(word);
         if (ipa.has_value()) return std::move(ipa.value());
         error("Could not convert '{}' to IPA: {}", word, ipa.error());
         return "";
     }(), text::NormalisationForm::NFC);
 
-    auto EmitSense = [&](const FullEntry::Sense& sense) {
-        json s;
-        s["def"] = tex_to_html(sense.def);
-        if (not sense.comment.empty()) s["comment"] = std::format("<p>{}</p>", tex_to_html(sense.comment));
-        if (not sense.examples.empty()) {
-            auto& ex = s["examples"] = json::array();
-            for (auto& example : sense.examples) {
-                json& j = ex.emplace_back();
-                j["text"] = tex_to_html(example.text);
-                if (not example.comment.empty()) j["comment"] = tex_to_html(example.comment);
-            }
+    // The text of all definitions is searchable.
+    std::string def_text;
+    auto ConvertSense = [&](const FullEntry::Sense& sense) {
+        HtmlSense s;
+        auto [def, text] = tex_to_html_and_text(sense.def);
+        s.def = std::move(def);
+        def_text += text;
+        if (not sense.comment.empty()) s.comment = std::format("<p>{}</p>", tex_to_html(sense.comment));
+        for (auto& example : sense.examples) {
+            auto& ex = s.examples.emplace_back(tex_to_html(example.text));
+            if (not example.comment.empty()) ex.comment = tex_to_html(example.comment);
         }
         return s;
     };
 
-    if (not data.etym.empty()) e["etym"] = tex_to_html(data.etym);
-    if (not data.primary_definition.def.empty()) e["def"] = EmitSense(data.primary_definition);
-    if (not data.forms.empty()) e["forms"] = tex_to_html(data.forms);
-    if (not data.senses.empty()) {
-        json& senses = e["senses"] = json::array();
-        for (auto& sense : data.senses) senses.push_back(EmitSense(sense));
-    }
+    if (not data.etym.empty()) e.etym = tex_to_html(data.etym);
+    if (not data.primary_definition.def.empty()) e.def = ConvertSense(data.primary_definition);
+    if (not data.forms.empty()) e.forms = tex_to_html(data.forms);
+    e.senses = data.senses | vws::transform(ConvertSense) | rgs::to<std::vector>();
 
     // Precomputed normalised strings for searching.
-    auto all_senses = utils::join(data.senses | vws::transform(&FullEntry::Sense::def), "");
-    e["hw-search"] = NormaliseForSearch(tex_to_html(word, true));
-    e["def-search"] = NormaliseForSearch(tex_to_html(data.primary_definition.def, true) + tex_to_html(all_senses, true));
+    e.hw_search = NormaliseForSearch(e.stripped_word);
+    e.def_search = NormaliseForSearch(def_text);
+    return e;
+}
+
+auto JsonBackend::ConvertRef(str word, const RefEntry& data) -> HtmlRef {
+    HtmlRef r;
+    std::tie(r.from, r.stripped_from) = tex_to_html_and_text(word);
+    current_word = r.from;
+    r.from_search = NormaliseForSearch(r.stripped_from);
+    r.to = tex_to_html(data);
+    return r;
+}
+
+void JsonBackend::emit(str word, const FullEntry& data) {
+    auto e = ConvertEntry(word, data);
+
+    // Write the entry; the keys need to be in sorted order.
+    auto WriteSense = [](JsonWriter& w, const HtmlSense& s) {
+        w.begin_object();
+        if (s.comment) w.key("comment").string(*s.comment);
+        w.key("def").string(s.def);
+        if (not s.examples.empty()) {
+            w.key("examples").begin_array();
+            for (auto& ex : s.examples) {
+                w.element().begin_object();
+                if (ex.comment) w.key("comment").string(*ex.comment);
+                w.key("text").string(ex.text);
+                w.end_object();
+            }
+            w.end_array();
+        }
+        w.end_object();
+    };
+
+    if (search_index) {
+        AddPostings(search_index->hw, e.hw_search, entry_count);
+        AddPostings(search_index->def, e.def_search, entry_count);
+    }
+
+    std::string initial;
+    if (sharding == Sharding::ByInitial) initial = Initial(e.stripped_word);
+
+    ProfileScope _{profiler, Phase::Serialise};
+    auto begin = output.size() + (entry_count ? 1 : 0);
+    auto w = begin_element(output, entry_count);
+    w.begin_object();
+    if (e.def) WriteSense(w.key("def"), *e.def);
+    w.key("def-search").string(e.def_search);
+    if (e.etym) w.key("etym").string(*e.etym);
+    if (e.forms) w.key("forms").string(*e.forms);
+    w.key("hw-search").string(e.hw_search);
+    w.key("ipa").string(e.ipa);
+    w.key("pos").string(e.pos);
+    if (not e.senses.empty()) {
+        w.key("senses").begin_array();
+        for (auto& sense : e.senses) WriteSense(w.element(), sense);
+        w.end_array();
+    }
+    w.key("word").string(e.word);
+    w.end_object();
+    if (sharding != Sharding::None)
+        shard_elements.emplace_back(std::move(initial), std::move(e.word), begin, output.size(), false);
 }
 
 void JsonBackend::emit(str word, const RefEntry& data) {
-    json& e = refs().emplace_back();
-    e["from"] = current_word = tex_to_html(word);
-    e["from-search"] = NormaliseForSearch(tex_to_html(current_word, true));
-    e["to"] = tex_to_html(data);
+    auto r = ConvertRef(word, data);
+    if (search_index) AddPostings(search_index->from, r.from_search, ref_count);
+
+    std::string initial;
+    if (sharding == Sharding::ByInitial) initial = Initial(r.stripped_from);
+
+    ProfileScope _{profiler, Phase::Serialise};
+    auto begin = refs_output.size() + (ref_count ? 1 : 0);
+    auto w = begin_element(refs_output, ref_count);
+    w.begin_object();
+    w.key("from").string(r.from);
+    w.key("from-search").string(r.from_search);
+    w.key("to").string(r.to);
+    w.end_object();
+    if (sharding != Sharding::None)
+        shard_elements.emplace_back(std::move(initial), std::move(r.from), begin, refs_output.size(), true);
 }
 
 void JsonBackend::emit_error(std::string error) {
@@ -159,19 +492,299 @@ void JsonBackend::emit_error(std::string error) {
     if (not errors.ends_with('\n')) errors += "\n";
 }
 
+auto JsonBackend::begin_element(std::string& buffer, usz& count) -> JsonWriter {
+    static constexpr usz ElementDepth = 2;
+    if (count++) buffer += ',';
+    JsonWriter w{buffer, minify, ElementDepth};
+    w.newline();
+    return w;
+}
+
+auto JsonBackend::fork() -> std::unique_ptr<Backend> {
+    auto f = std::unique_ptr<JsonBackend>{new JsonBackend(ops, minify, search_index != nullptr, false)};
+    f->sharding = sharding;
+    f->shard_size = shard_size;
+    return f;
+}
+
+void JsonBackend::join(Backend& b) {
+    auto& fork = static_cast<JsonBackend&>(b);
+    has_error |= std::exchange(fork.has_error, false);
+    errors += std::move(fork.errors);
+    fork.errors.clear();
+
+    // Merge the index first since this needs the counts from before the join.
+    if (search_index) {
+        MergePostings(search_index->def, fork.search_index->def, entry_count);
+        MergePostings(search_index->from, fork.search_index->from, ref_count);
+        MergePostings(search_index->hw, fork.search_index->hw, entry_count);
+    }
+
+    // Likewise, the fork’s elements need to be shifted by the size of our
+    // buffers, plus the comma that we insert below.
+    if (sharding != Sharding::None) {
+        auto Offset = [](const std::string& buffer, usz count, usz fork_count) {
+            return buffer.size() + (count and fork_count ? 1 : 0);
+        };
+
+        auto entries_offset = Offset(output, entry_count, fork.entry_count);
+        auto refs_offset = Offset(refs_output, ref_count, fork.ref_count);
+        for (auto& e : fork.shard_elements) {
+            auto offset = e.ref ? refs_offset : entries_offset;
+            e.begin += offset;
+            e.end += offset;
+            shard_elements.push_back(std::move(e));
+        }
+        fork.shard_elements.clear();
+    }
+
+    auto Append = [](std::string& buffer, usz& count, std::string& fork_buffer, usz& fork_count) {
+        if (count and fork_count) buffer += ',';
+        buffer += fork_buffer;
+        count += std::exchange(fork_count, 0);
+        fork_buffer.clear();
+    };
+
+    Append(output, entry_count, fork.output, fork.entry_count);
+    Append(refs_output, ref_count, fork.refs_output, fork.ref_count);
+}
+
+auto JsonBackend::ipa_source(str word, const FullEntry& data) -> std::optional<std::string> {
+    if (not data.ipa.empty()) return std::nullopt;
+    return word.string();
+}
+
+auto JsonBackend::cache_tag() const -> std::string {
+    std::string tag = "json";
+    if (minify) tag += ":minify";
+    if (search_index) tag += ":index";
+    if (sharding == Sharding::ByInitial) tag += ":sharded-initial";
+    if (sharding == Sharding::BySize) tag += ":sharded-size";
+    return tag;
+}
+
+// Fragments contain a single entry or reference; the first character
+// indicates which one it is. If we’re building a search index, this is
+// followed by the entry’s 'hw-search' and 'def-search' tokens or the
+// reference’s 'from-search' tokens, each terminated by a line break. If
+// we’re sharding, the initial and the word come next, in the same format.
+auto JsonBackend::take_fragment() -> std::optional<std::string> {
+    Assert(entry_count + ref_count == 1, "Fragment must contain exactly one entry");
+    std::string fragment = entry_count ? "e" : "r";
+    if (search_index) {
+        if (entry_count) fragment += Tokens(search_index->hw) + '\n' + Tokens(search_index->def) + '\n';
+        else fragment += Tokens(search_index->from) + '\n';
+        *search_index = {};
+    }
+
+    if (sharding != Sharding::None) {
+        Assert(shard_elements.size() == 1);
+        fragment += shard_elements.front().initial + '\n' + shard_elements.front().word + '\n';
+        shard_elements.clear();
+    }
+
+    fragment += entry_count ? std::move(output) : std::move(refs_output);
+    output.clear();
+    refs_output.clear();
+    entry_count = ref_count = 0;
+    errors.clear();
+    if (std::exchange(has_error, false)) return std::nullopt;
+    return fragment;
+}
+
+void JsonBackend::splice(str fragment) {
+    auto ref = fragment.consume('r');
+    if (not ref) Assert(fragment.consume('e'), "Invalid fragment");
+    auto& buffer = ref ? refs_output : output;
+    auto& count = ref ? ref_count : entry_count;
+    if (search_index) {
+        if (ref) {
+            AddPostings(search_index->from, fragment.take_until_and_drop("\n"), count);
+        } else {
+            AddPostings(search_index->hw, fragment.take_until_and_drop("\n"), count);
+            AddPostings(search_index->def, fragment.take_until_and_drop("\n"), count);
+        }
+    }
+
+    std::string initial, word;
+    if (sharding != Sharding::None) {
+        initial = fragment.take_until_and_drop("\n").string();
+        word = fragment.take_until_and_drop("\n").string();
+    }
+
+    if (count++) buffer += ',';
+    auto begin = buffer.size();
+    buffer += fragment;
+    if (sharding != Sharding::None)
+        shard_elements.emplace_back(std::move(initial), std::move(word), begin, buffer.size(), ref);
+}
+
 void JsonBackend::finish() {
-    if (has_error) output = std::move(errors);
-    else output = minify ? out.dump() : out.dump(4);
+    if (has_error) {
+        output = std::move(errors);
+        return;
+    }
+
+    if (sharding != Sharding::None) return FinishSharded();
+    CloseDocument(output, entry_count, refs_output, ref_count, search_index != nullptr);
+}
+
+void JsonBackend::FinishSharded() {
+    // Shards are contiguous runs of elements.
+    std::vector<std::span<const ShardElement>> groups;
+    for (usz start = 0, i = 1; i <= shard_elements.size(); i++) {
+        bool split = i == shard_elements.size() or (
+            sharding == Sharding::ByInitial
+                ? shard_elements[i].initial != shard_elements[i - 1].initial
+                : i - start == shard_size
+        );
+
+        if (split) {
+            groups.push_back(std::span{shard_elements}.subspan(start, i - start));
+            start = i;
+        }
+    }
+
+    std::string manifest;
+    JsonWriter m{manifest, minify, 0};
+    m.begin_object();
+    if (search_index) WriteIndex(m.key("index"));
+    m.key("shards").begin_array();
+    for (auto [i, group] : utils::enumerate(groups)) {
+        // Reuse the serialised elements; they are already in the right format.
+        std::string entries, refs;
+        usz entries_count = 0, refs_count = 0;
+        for (auto& e : group) {
+            auto& buffer = e.ref ? refs : entries;
+            auto& count = e.ref ? refs_count : entries_count;
+            if (count++) buffer += ',';
+            buffer += std::string_view{e.ref ? refs_output : output}.substr(e.begin, e.end - e.begin);
+        }
+
+        auto& shard = shard_files.emplace_back(std::format("shard-{}.json", i));
+        OpenDocument(shard.contents);
+        shard.contents += entries;
+        CloseDocument(shard.contents, entries_count, refs, refs_count, false);
+
+        m.element().begin_object();
+        m.key("entries").number(entries_count);
+        m.key("file").string(shard.name);
+        m.key("first").string(group.front().word);
+        if (sharding == Sharding::ByInitial) m.key("initial").string(group.front().initial);
+        m.key("last").string(group.back().word);
+        m.key("refs").number(refs_count);
+        m.end_object();
+    }
+
+    m.end_array();
+    m.end_object();
+    output = std::move(manifest);
+    refs_output.clear();
+    shard_elements.clear();
+}
+
+void JsonBackend::OpenDocument(std::string& out) {
+    out += '{';
+    JsonWriter{out, minify, 1}.key("entries").begin_array();
+}
+
+void JsonBackend::CloseDocument(std::string& out, usz entries, str refs, usz refs_count, bool index) {
+    // Close the entries array and append the references.
+    auto CloseArray = [&](usz count) {
+        JsonWriter w{out, minify, 1};
+        if (count) w.newline();
+        out += ']';
+    };
+
+    CloseArray(entries);
+    out += ',';
+
+    // Write the search index.
+    if (index) {
+        JsonWriter w{out, minify, 1};
+        WriteIndex(w.key("index"));
+        out += ',';
+    }
+
+    JsonWriter{out, minify, 1}.key("refs").begin_array();
+    out += refs;
+    CloseArray(refs_count);
+    JsonWriter{out, minify, 0}.newline();
+    out += '}';
+}
+
+void JsonBackend::WriteIndex(JsonWriter& w) {
+    auto WritePostings = [](JsonWriter& pw, const SearchIndex::Postings& postings) {
+        pw.begin_object();
+        for (auto& [token, indices] : postings) {
+            pw.key(token).begin_array();
+            for (usz prev = 0; auto i : indices) {
+                pw.element().number(i - prev);
+                prev = i;
+            }
+            pw.end_array();
+        }
+        pw.end_object();
+    };
+
+    w.begin_object();
+    WritePostings(w.key("def"), search_index->def);
+    WritePostings(w.key("from"), search_index->from);
+    WritePostings(w.key("hw"), search_index->hw);
+    w.end_object();
+}
+
+void JsonBackend::shard_by_initial() {
+    sharding = Sharding::ByInitial;
+}
+
+void JsonBackend::shard_by_size(usz elements) {
+    Assert(elements != 0, "Shard size must not be zero");
+    sharding = Sharding::BySize;
+    shard_size = elements;
+}
+
+auto JsonBackend::write_shards(const std::filesystem::path& dir) const -> Result<> {
+    if (has_error) return Error("Cannot write shards: the dictionary has errors");
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) return Error("Could not create '{}': {}", dir.string(), ec.message());
+
+    auto Write = [](const std::filesystem::path& path, str contents) -> Result<> {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        if (not out) return Error("Could not open '{}' for writing", path.string());
+        out.write(contents.data(), std::streamsize(contents.size()));
+        if (not out.flush()) return Error("Could not write to '{}'", path.string());
+        return {};
+    };
+
+    for (auto& s : shard_files) Try(Write(dir / s.name, s.contents));
+    return Write(dir / "manifest.json", output);
 }
 
 auto JsonBackend::tex_to_html(str input, bool strip_macros) -> std::string {
-    auto res = TexParser::Parse(*this, input);
+    defer { arena.reset(); };
+    auto Render = [&](auto r) -> std::string {
+        ProfileScope _{profiler, Phase::Render};
+        auto res = TexParser::Render(*this, input, r);
+        if (not res.has_value()) {
+            error("{}", res.error());
+            return "";
+        }
+        return std::move(r.out);
+    };
+
+    return strip_macros ? Render(Renderer<true>{*this}) : Render(Renderer<false>{*this});
+}
+
+auto JsonBackend::tex_to_html_and_text(str input) -> std::pair<std::string, std::string> {
+    defer { arena.reset(); };
+    ProfileScope _{profiler, Phase::Render};
+    DualRenderer r{Renderer<false>{*this}, Renderer<true>{*this}};
+    auto res = TexParser::Render(*this, input, r);
     if (not res.has_value()) {
         error("{}", res.error());
-        return "";
+        return {};
     }
-
-    Renderer r{*this, strip_macros};
-    r.render(*res.value());
-    return std::move(r.out);
+    return {std::move(r.first.out), std::move(r.second.out)};
 }
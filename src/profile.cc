@@ -0,0 +1,55 @@
+#include <dictgen/profile.hh>
+#include <nlohmann/json.hpp>
+
+using namespace dict;
+
+auto Profile::Name(Phase p) -> str {
+    switch (p) {
+        case Phase::Parse: return "parse";
+        case Phase::Preprocess: return "preprocess";
+        case Phase::SplitSenses: return "split-senses";
+        case Phase::Sort: return "sort";
+        case Phase::Emit: return "emit";
+        case Phase::TexParse: return "tex-parse";
+        case Phase::Render: return "render";
+        case Phase::ToIPA: return "to-ipa";
+        case Phase::NormaliseForSearch: return "normalise-for-search";
+        case Phase::Serialise: return "serialise";
+        case Phase::Count: break;
+    }
+
+    Unreachable("Invalid phase");
+}
+
+auto Profile::to_json() const -> std::string {
+    nlohmann::json j = nlohmann::json::object();
+    for (usz i = 0; i < phases.size(); i++) {
+        j[Name(Phase(i)).string()] = {
+            {"ns", phases[i].time.count()},
+            {"calls", phases[i].calls},
+        };
+    }
+    return j.dump(4);
+}
+
+auto Profiler::Register() -> Shard& {
+    std::unique_lock lock{mutex};
+    auto thread = std::this_thread::get_id();
+    auto it = rgs::find(shards, thread, &Shard::thread);
+    if (it != shards.end()) return **it;
+    auto& s = *shards.emplace_back(std::make_unique<Shard>());
+    s.thread = thread;
+    return s;
+}
+
+auto Profiler::snapshot() const -> Profile {
+    std::unique_lock lock{mutex};
+    Profile p;
+    for (auto& s : shards) {
+        for (usz i = 0; i < s->counters.size(); i++) {
+            p.phases[i].time += std::chrono::nanoseconds{s->counters[i].ns.load(std::memory_order_relaxed)};
+            p.phases[i].calls += s->counters[i].calls.load(std::memory_order_relaxed);
+        }
+    }
+    return p;
+}
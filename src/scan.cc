@@ -0,0 +1,183 @@
+#include <dictgen/scan.hh>
+#include <array>
+#include <bit>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#    define DICTGEN_SCAN_X86 1
+#    include <immintrin.h>
+#endif
+
+// On GCC and Clang, we compile the AVX2 kernels even if the compiler isn’t
+// allowed to use AVX2 everywhere, and only call them if the CPU supports it.
+#if defined(DICTGEN_SCAN_X86) and (defined(__AVX2__) or defined(__GNUC__))
+#    define DICTGEN_SCAN_AVX2 1
+#endif
+
+#if defined(DICTGEN_SCAN_AVX2) and not defined(__AVX2__)
+#    define DICTGEN_TARGET_AVX2 [[gnu::target("avx2")]]
+#else
+#    define DICTGEN_TARGET_AVX2
+#endif
+
+using namespace dict;
+using namespace dict::scan;
+
+namespace {
+constexpr auto MacroLetter = [] {
+    std::array<bool, 256> table{};
+    for (u8 c = 'a'; c <= 'z'; c++) table[c] = table[c - 'a' + 'A'] = true;
+    table['@'] = true;
+    return table;
+}();
+
+/// Find the first occurrence of any of a set of bytes.
+///
+/// All SIMD kernels compute a mask of the bytes we’re looking for in each
+/// block, and stop at the first set bit; the tail is handled by the next
+/// smaller implementation, since we can’t read past the end of the input.
+template <char... Chars>
+struct FindAny {
+    static constexpr auto Table = [] {
+        std::array<bool, 256> table{};
+        ((table[u8(Chars)] = true), ...);
+        return table;
+    }();
+
+    static auto Portable(const char* data, usz size) -> usz {
+        for (usz i = 0; i < size; i++)
+            if (Table[u8(data[i])]) return i;
+        return size;
+    }
+
+#ifdef DICTGEN_SCAN_X86
+    // SSE2 is part of x86-64, so this is always available there.
+    static auto SSE2(const char* data, usz size) -> usz {
+        usz i = 0;
+        for (; i + 16 <= size; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            auto m = _mm_setzero_si128();
+            ((m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(Chars)))), ...);
+            if (auto bits = u32(_mm_movemask_epi8(m))) return i + usz(std::countr_zero(bits));
+        }
+
+        return i + Portable(data + i, size - i);
+    }
+#endif
+
+#ifdef DICTGEN_SCAN_AVX2
+    DICTGEN_TARGET_AVX2 static auto AVX2(const char* data, usz size) -> usz {
+        usz i = 0;
+        for (; i + 32 <= size; i += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            auto m = _mm256_setzero_si256();
+            ((m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(Chars)))), ...);
+            if (auto bits = u32(_mm256_movemask_epi8(m))) return i + usz(std::countr_zero(bits));
+        }
+
+        return i + SSE2(data + i, size - i);
+    }
+#endif
+};
+
+using FindTexSpecial = FindAny<'\\', '$', '{', '}'>;
+using FindHtmlEscape = FindAny<'<', '>', '&', '~'>;
+using FindTypstEscape = FindAny<'*', '_', '`', '<', '@', '=', '-', '+', '/', '\\', '#', '$'>;
+
+auto CountMacroLettersPortable(const char* data, usz size) -> usz {
+    for (usz i = 0; i < size; i++)
+        if (not MacroLetter[u8(data[i])]) return i;
+    return size;
+}
+
+#ifdef DICTGEN_SCAN_X86
+// A byte is a letter if, after folding the case, it is in ['a', 'z']. SSE2
+// only has signed comparisons, so we shift the range to start at -128.
+auto CountMacroLettersSSE2(const char* data, usz size) -> usz {
+    const auto fold = _mm_set1_epi8(0x20);
+    const auto shift = _mm_set1_epi8(char(0x80 - 'a'));
+    const auto limit = _mm_set1_epi8(char(0x80 + 26));
+    const auto at = _mm_set1_epi8('@');
+
+    usz i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto folded = _mm_add_epi8(_mm_or_si128(v, fold), shift);
+        auto m = _mm_or_si128(_mm_cmplt_epi8(folded, limit), _mm_cmpeq_epi8(v, at));
+        if (auto bits = ~u32(_mm_movemask_epi8(m)) & 0xFFFF) return i + usz(std::countr_zero(bits));
+    }
+
+    return i + CountMacroLettersPortable(data + i, size - i);
+}
+#endif
+
+#ifdef DICTGEN_SCAN_AVX2
+DICTGEN_TARGET_AVX2 auto CountMacroLettersAVX2(const char* data, usz size) -> usz {
+    const auto fold = _mm256_set1_epi8(0x20);
+    const auto shift = _mm256_set1_epi8(char(0x80 - 'a'));
+    const auto limit = _mm256_set1_epi8(char(0x80 + 26));
+    const auto at = _mm256_set1_epi8('@');
+
+    usz i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto folded = _mm256_add_epi8(_mm256_or_si256(v, fold), shift);
+        auto m = _mm256_or_si256(_mm256_cmpgt_epi8(limit, folded), _mm256_cmpeq_epi8(v, at));
+        if (auto bits = ~u32(_mm256_movemask_epi8(m))) return i + usz(std::countr_zero(bits));
+    }
+
+    return i + CountMacroLettersSSE2(data + i, size - i);
+}
+
+auto SupportsAVX2() -> bool {
+#    if defined(__AVX2__)
+    return true;
+#    else
+    return __builtin_cpu_supports("avx2");
+#    endif
+}
+#endif
+
+auto DetectImplementations() -> std::vector<Kernels> {
+    std::vector<Kernels> kernels;
+    kernels.emplace_back(
+        "portable",
+        FindTexSpecial::Portable,
+        CountMacroLettersPortable,
+        FindHtmlEscape::Portable,
+        FindTypstEscape::Portable
+    );
+
+#ifdef DICTGEN_SCAN_X86
+    kernels.emplace_back(
+        "sse2",
+        FindTexSpecial::SSE2,
+        CountMacroLettersSSE2,
+        FindHtmlEscape::SSE2,
+        FindTypstEscape::SSE2
+    );
+#endif
+
+#ifdef DICTGEN_SCAN_AVX2
+    if (SupportsAVX2()) kernels.emplace_back(
+        "avx2",
+        FindTexSpecial::AVX2,
+        CountMacroLettersAVX2,
+        FindHtmlEscape::AVX2,
+        FindTypstEscape::AVX2
+    );
+#endif
+
+    return kernels;
+}
+}
+
+auto scan::Implementations() -> std::span<const Kernels> {
+    static const auto kernels = DetectImplementations();
+    return kernels;
+}
+
+auto scan::Best() -> const Kernels& {
+    static const Kernels& best = Implementations().back();
+    return best;
+}
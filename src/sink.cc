@@ -0,0 +1,126 @@
+#include <dictgen/sink.hh>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#    include <fcntl.h>
+#    include <io.h>
+#    include <sys/stat.h>
+#else
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+using namespace dict;
+
+namespace {
+auto OpenForWriting(const std::filesystem::path& path) -> int {
+#ifdef _WIN32
+    return ::_wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+}
+
+void CloseFile(int fd) {
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+/// Write some data; returns the number of bytes written, or -1 on error.
+auto WriteSome(int fd, const char* data, usz size) -> i64 {
+#ifdef _WIN32
+    return ::_write(fd, data, unsigned(std::min<usz>(size, INT_MAX)));
+#else
+    return ::write(fd, data, size);
+#endif
+}
+}
+
+FileSink::FileSink(int fd, bool owned) : fd{fd}, owned{owned} {
+    buffer.reserve(BufferSize);
+}
+
+FileSink::FileSink(FileSink&& other) noexcept
+    : fd{std::exchange(other.fd, -1)},
+      owned{std::exchange(other.owned, false)},
+      buffer{std::move(other.buffer)},
+      write_error{std::move(other.write_error)} {}
+
+FileSink& FileSink::operator=(FileSink&& other) noexcept {
+    if (this == &other) return *this;
+    Close();
+    fd = std::exchange(other.fd, -1);
+    owned = std::exchange(other.owned, false);
+    buffer = std::move(other.buffer);
+    write_error = std::move(other.write_error);
+    return *this;
+}
+
+FileSink::~FileSink() { Close(); }
+
+auto FileSink::Open(const std::filesystem::path& path) -> Result<FileSink> {
+    auto fd = OpenForWriting(path);
+    if (fd < 0) return Error("Could not open '{}': {}", path.string(), std::strerror(errno));
+    return FileSink{fd, true};
+}
+
+// Flush the C streams first so anything printed before stays in order.
+auto FileSink::Stdout() -> FileSink {
+    std::fflush(stdout);
+    return FileSink{1, false};
+}
+
+auto FileSink::Stderr() -> FileSink {
+    std::fflush(stderr);
+    return FileSink{2, false};
+}
+
+void FileSink::Close() {
+    if (fd < 0) return;
+    WriteBuffer();
+    if (owned) CloseFile(fd);
+    fd = -1;
+}
+
+auto FileSink::flush() -> Result<> {
+    WriteBuffer();
+    if (write_error) return Error("{}", *write_error);
+    return {};
+}
+
+void FileSink::write(str data) {
+    if (buffer.size() + data.size() <= BufferSize) {
+        buffer += data;
+        return;
+    }
+
+    // Don’t bother copying large chunks into the buffer.
+    WriteBuffer();
+    if (data.size() >= BufferSize) WriteAll(data);
+    else buffer += data;
+}
+
+void FileSink::WriteAll(str data) {
+    if (write_error or fd < 0) return;
+    while (not data.empty()) {
+        auto n = WriteSome(fd, data.data(), data.size());
+        if (n < 0 and errno == EINTR) continue;
+        if (n < 0) {
+            write_error = std::format("Could not write output: {}", std::strerror(errno));
+            return;
+        }
+
+        data.drop(usz(n));
+    }
+}
+
+void FileSink::WriteBuffer() {
+    WriteAll(buffer);
+    buffer.clear();
+}
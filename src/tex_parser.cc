@@ -1,38 +1,175 @@
 #include <dictgen/backends.hh>
+#include <dictgen/scan.hh>
 #include <base/Text.hh>
 
 using namespace dict;
 
-void Renderer::render(const Node& n) {
-    if (n.is<EmptyNode>()) return;
-    if (auto t = n.as<TextNode>()) return render_text(t->text);
-    if (auto m = n.as<MacroNode>()) return render_macro(*m);
-    if (auto c = n.as<ContentNode>()) return render(c->children);
-    if (auto t = n.as<ComputedTextNode>()) return render_text(t->text);
-    if (auto t = n.as<FormattingNode>()) return render_formatting(t->text);
-    Unreachable("Invalid node type");
+namespace {
+enum class BuiltinAction : u8 {
+    SingleArgument,  ///< Parse one argument and wrap it in a MacroNode.
+    NoArguments,     ///< Emit a MacroNode without arguments.
+    DiscardArgument, ///< Parse one argument and throw it away.
+    Ignore,          ///< Emit nothing.
+};
+
+struct Builtin {
+    std::string_view name;
+    BuiltinAction action;
+    Macro macro;
+};
+
+constexpr Builtin Builtins[]{
+    {"s", BuiltinAction::SingleArgument, Macro::SmallCaps},
+    {"w", BuiltinAction::SingleArgument, Macro::Lemma},
+    {"textit", BuiltinAction::SingleArgument, Macro::Italic},
+    {"textbf", BuiltinAction::SingleArgument, Macro::Bold},
+    {"textnf", BuiltinAction::SingleArgument, Macro::Normal},
+    {"senseref", BuiltinAction::SingleArgument, Macro::Sense},
+    {"Sup", BuiltinAction::SingleArgument, Macro::Superscript},
+    {"Sub", BuiltinAction::SingleArgument, Macro::Subscript},
+    {"par", BuiltinAction::NoArguments, Macro::ParagraphBreak},
+    {"ldots", BuiltinAction::NoArguments, Macro::Ellipsis},
+    {"this", BuiltinAction::NoArguments, Macro::This},
+    {"ref", BuiltinAction::DiscardArgument, {}},
+    {"label", BuiltinAction::DiscardArgument, {}},
+
+    // Already handled when we split senses and examples.
+    {"ex", BuiltinAction::Ignore, {}},
+    {"comment", BuiltinAction::Ignore, {}},
+};
+
+// Perfect hash table for the builtin macros. We search for a seed that maps
+// every builtin to a different slot at compile time, so a lookup is a hash
+// and a single string comparison.
+constexpr usz BuiltinTableSize = 64;
+static_assert(std::size(Builtins) <= BuiltinTableSize / 2, "Increase the table size");
+
+constexpr auto HashBuiltin(std::string_view s, u32 seed) -> usz {
+    u32 h = seed;
+    for (char c : s) h = (h ^ u8(c)) * 0x0100'0193;
+    return (h ^ (h >> 16)) & (BuiltinTableSize - 1);
+}
+
+constexpr u32 BuiltinSeed = [] {
+    for (u32 seed = 0x811C'9DC5;; seed++) {
+        std::array<bool, BuiltinTableSize> used{};
+        bool ok = true;
+        for (auto& b : Builtins) {
+            auto h = HashBuiltin(b.name, seed);
+            ok = ok and not used[h];
+            used[h] = true;
+        }
+        if (ok) return seed;
+    }
+}();
+
+constexpr auto BuiltinTable = [] {
+    std::array<const Builtin*, BuiltinTableSize> table{};
+    for (auto& b : Builtins) table[HashBuiltin(b.name, BuiltinSeed)] = &b;
+    return table;
+}();
+
+constexpr auto FindBuiltin(std::string_view name) -> const Builtin* {
+    auto b = BuiltinTable[HashBuiltin(name, BuiltinSeed)];
+    return b and b->name == name ? b : nullptr;
+}
+
+static_assert(FindBuiltin("textit")->macro == Macro::Italic);
+static_assert(FindBuiltin("comment")->action == BuiltinAction::Ignore);
+static_assert(not FindBuiltin("textsc"));
+}
+
+void MacroRegistry::add(str name, usz arity, Handler handler) {
+    std::string_view sv{name.data(), name.size()};
+    Assert(not FindBuiltin(sv), "Cannot redefine builtin macro '{}'", name);
+    auto inserted = definitions.try_emplace(name.string(), arity, std::move(handler)).second;
+    Assert(inserted, "Macro '{}' is already defined", name);
+}
+
+void MacroRegistry::add_formatting(str name, str expansion) {
+    add(name, 0, [expansion = expansion.string()](TexParser& p, std::span<const Node::Ptr>) -> Result<Node::Ptr> {
+        return p.formatting(expansion);
+    });
+}
+
+void MacroRegistry::add_text(str name, str expansion) {
+    add(name, 0, [expansion = expansion.string()](TexParser& p, std::span<const Node::Ptr>) -> Result<Node::Ptr> {
+        return p.text(expansion);
+    });
 }
 
-void Renderer::render(std::span<const Node::Ptr> nodes) {
-    for (const auto& n : nodes) render(*n);
+auto MacroRegistry::find(str name) const -> const Definition* {
+    auto it = definitions.find(std::string_view{name.data(), name.size()});
+    return it == definitions.end() ? nullptr : &it->second;
 }
 
+TexParser::TexParser(Backend& backend, str input)
+    : backend(backend), arena(backend.arena), input(input) {}
+
 auto TexParser::parse_arg() -> Result<Node::Ptr> {
     if (not input.trim_front().starts_with('{')) return Error("Missing arg for macro");
+
+    // Macro handlers always get a tree, even if we’re streaming.
+    auto saved = std::exchange(sink, nullptr);
+    defer { sink = saved; };
     return ParseGroup();
 }
 
+void TexParser::AddComputedText(str text) {
+    if (not sink) stack.push_back(this->text(text));
+    else if (not skip_depth) sink->render_text(text);
+}
+
+void TexParser::AddEmpty() {
+    if (not sink) stack.push_back(Make<EmptyNode>());
+}
+
+void TexParser::AddMacro(Macro m) {
+    if (not sink) stack.push_back(Make<MacroNode>(m));
+    else if (not skip_depth and sink->begin_macro(m)) sink->end_macro(m);
+}
+
+void TexParser::AddNode(Node::Ptr node) {
+    if (not sink) stack.push_back(node);
+    else if (not skip_depth) sink->render(*node);
+}
+
+void TexParser::AddText(str text) {
+    if (not sink) stack.push_back(Make<TextNode>(text));
+    else if (not skip_depth) sink->render_text(text);
+}
+
+auto TexParser::ExpandMacro(const MacroRegistry::Definition& def) -> Result<Node::Ptr> {
+    auto saved = std::exchange(sink, nullptr);
+    auto start = stack.size();
+    defer {
+        sink = saved;
+        stack.erase(stack.begin() + isz(start), stack.end());
+    };
+
+    for (usz i = 0; i < def.arity; i++) {
+        if (not input.trim_front().starts_with('{'))
+            return Error("Sorry, macro arguments must be enclosed in braces");
+        stack.push_back(Try(ParseGroup()));
+    }
+
+    return def.handler(*this, PopNodes(start));
+}
+
 auto TexParser::HandleUnknownMacro(str macro) -> Result<Node::Ptr> {
+    if (auto def = backend.ops.macros().find(macro)) return ExpandMacro(*def);
     return backend.ops.handle_unknown_macro(*this, macro);
 }
 
-auto TexParser::ParseContent(std::vector<Node::Ptr>& nodes, i32 braces) -> Result<> {
+auto TexParser::ParseContent(i32 braces) -> Result<> {
     while (not input.empty()) {
-        nodes.push_back(Make<TextNode>(input.take_until_any("\\${}")));
+        if (auto text = input.take(scan::FindTexSpecial(input)); not text.empty())
+            AddText(text);
+
         switch (input.front().value_or(0)) {
             default: break;
-            case '\\': nodes.push_back(Try(ParseMacro())); break;
-            case '$': nodes.push_back(Try(ParseMaths())); break;
+            case '\\': Try(ParseMacro()); break;
+            case '$': Try(ParseMaths()); break;
 
             case '{':
                 input.drop();
@@ -56,14 +193,16 @@ auto TexParser::ParseContent(std::vector<Node::Ptr>& nodes, i32 braces) -> Resul
 }
 
 auto TexParser::ParseGroup() -> Result<Node::Ptr> {
+    Assert(not sink, "ParseGroup() always builds a tree");
     Assert(input.consume('{'), "Expected brace");
     if (input.consume('}')) return Make<EmptyNode>();
-    std::vector<Node::Ptr> children;
-    Try(ParseContent(children, 1));
-    return Make<ContentNode>(std::move(children));
+    auto start = stack.size();
+    defer { stack.erase(stack.begin() + isz(start), stack.end()); };
+    Try(ParseContent(1));
+    return Make<ContentNode>(PopNodes(start));
 }
 
-auto TexParser::ParseMacro() -> Result<Node::Ptr> {
+auto TexParser::ParseMacro() -> Result<> {
     Assert(input.consume('\\'), "Expected backslash");
     if (input.empty()) return Error("Invalid macro escape sequence");
 
@@ -72,65 +211,91 @@ auto TexParser::ParseMacro() -> Result<Node::Ptr> {
         static constexpr str SpecialChars = "- &$%#{}";
         auto c = input.take();
         if (SpecialChars.contains(c[0])) {
-            if (c[0] == '-') return Make<MacroNode>(Macro::SoftHyphen);
-            return Make<TextNode>(c);
+            if (c[0] == '-') AddMacro(Macro::SoftHyphen);
+            else AddText(c);
+            return {};
         }
 
         if (c[0] == '\\') return Error("'\\\\' is not supported in this field");
-        return HandleUnknownMacro(c);
+        AddNode(Try(HandleUnknownMacro(c)));
+        return {};
     }
 
     // Handle regular macros. We use custom tags for some of these to
     // separate the formatting from data.
-    auto macro = input.take_while_any("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ@");
+    auto macro = input.take(scan::CountMacroLetters(input));
     if (macro.empty()) return Error("Invalid macro escape sequence");
     input.trim_front();
 
     // Builtin macros.
-    if (macro == "s") return ParseSingleArgumentMacro(Macro::SmallCaps);
-    if (macro == "w") return ParseSingleArgumentMacro(Macro::Lemma);
-    if (macro == "textit") return ParseSingleArgumentMacro(Macro::Italic);
-    if (macro == "textbf") return ParseSingleArgumentMacro(Macro::Bold);
-    if (macro == "textnf") return ParseSingleArgumentMacro(Macro::Normal);
-    if (macro == "senseref") return ParseSingleArgumentMacro(Macro::Sense);
-    if (macro == "Sup") return ParseSingleArgumentMacro(Macro::Superscript);
-    if (macro == "Sub") return ParseSingleArgumentMacro(Macro::Subscript);
-    if (macro == "par") return Make<MacroNode>(Macro::ParagraphBreak);
-    if (macro == "ldots") return Make<MacroNode>(Macro::Ellipsis);
-    if (macro == "this") return Make<MacroNode>(Macro::This);
-    if (macro == "ref" or macro == "label" ) {
-        (void) ParseGroup(); // Throw away the argument.
-        return Make<EmptyNode>();
+    if (auto b = FindBuiltin(std::string_view{macro.data(), macro.size()})) {
+        switch (b->action) {
+            case BuiltinAction::SingleArgument: return ParseSingleArgumentMacro(b->macro);
+            case BuiltinAction::NoArguments: AddMacro(b->macro); return {};
+            case BuiltinAction::DiscardArgument: {
+                auto saved = std::exchange(sink, nullptr);
+                (void) ParseGroup(); // Throw away the argument.
+                sink = saved;
+                AddEmpty();
+                return {};
+            }
+            case BuiltinAction::Ignore: AddEmpty(); return {};
+        }
+        Unreachable();
     }
 
-    // Already handled when we split senses and examples.
-    if (macro == "ex" or macro == "comment")
-        return Make<EmptyNode>();
-
     // User-defined macro.
-    return HandleUnknownMacro(macro);
+    AddNode(Try(HandleUnknownMacro(macro)));
+    return {};
 }
 
-auto TexParser::ParseMaths() -> Result<Node::Ptr> {
+auto TexParser::ParseMaths() -> Result<> {
     Assert(input.consume('$'), "Expected '$'");
-    auto node = Make<ComputedTextNode>(std::format("${}$", input.take_until('$'))); // TODO: Actually support maths.
+    auto maths = std::format("${}$", input.take_until('$')); // TODO: Actually support maths.
     if (not input.consume('$')) return Error("Unterminated maths");
-    return node;
+    AddComputedText(maths);
+    return {};
 }
 
 auto TexParser::Parse(Backend& backend, str input) -> Result<Node::Ptr> {
+    ProfileScope _{backend.profiler, Phase::TexParse};
     TexParser parser{backend, input};
-    std::vector<Node::Ptr> children;
-    while (not parser.input.empty()) Try(parser.ParseContent(children, 0));
-    return Make<ContentNode>(std::move(children));
+    while (not parser.input.empty()) Try(parser.ParseContent(0));
+    return parser.Make<ContentNode>(parser.PopNodes(0));
 }
 
-auto TexParser::ParseSingleArgumentMacro(Macro m) -> Result<Node::Ptr> {
+auto TexParser::PopNodes(usz start) -> std::span<const Node::Ptr> {
+    auto nodes = arena.copy(std::span<const Node::Ptr>{stack}.subspan(start));
+    stack.erase(stack.begin() + isz(start), stack.end());
+    return nodes;
+}
+
+auto TexParser::ParseSingleArgumentMacro(Macro m) -> Result<> {
     // Drop everything until the argument brace. We’re not a LaTeX tokeniser, so we don’t
     // support stuff like `\fract1 2`, as much as I like to write it.
     if (not input.trim_front().starts_with('{'))
         return Error("Sorry, macro arguments must be enclosed in braces");
 
-    auto arg = Try(parse_arg());
-    return Make<MacroNode>(m, std::move(arg));
+    if (not sink) {
+        auto arg = Try(parse_arg());
+        stack.push_back(Make<MacroNode>(m, arena.copy(std::span<const Node::Ptr>{&arg, 1})));
+        return {};
+    }
+
+    // Stream the argument between the begin and end events; if the sink
+    // doesn’t want it, we still need to parse it, but we drop everything.
+    bool render = not skip_depth and sink->begin_macro(m);
+    if (not render) skip_depth++;
+    input.drop();
+    Try(ParseContent(1));
+    if (render) sink->end_macro(m);
+    else skip_depth--;
+    return {};
+}
+
+auto TexParser::Render(Backend& backend, str input, RenderSink& sink) -> Result<> {
+    TexParser parser{backend, input};
+    parser.sink = &sink;
+    while (not parser.input.empty()) Try(parser.ParseContent(0));
+    return {};
 }
@@ -0,0 +1,55 @@
+#include <dictgen/transliterator.hh>
+#include <mutex>
+#include <unordered_map>
+
+using namespace dict;
+
+struct TransliteratorRegistry::Pool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<text::Transliterator>> free;
+};
+
+auto TransliteratorRegistry::Acquire(str rules) -> Lease {
+    // Pools are never destroyed, so we can hand out pointers to them; this
+    // is intentionally leaked so that leases that are released during static
+    // destruction or on detached threads don’t touch a destroyed pool.
+    static auto& mutex = *new std::mutex;
+    static auto& pools = *new std::unordered_map<std::string, std::unique_ptr<Pool>>;
+    Pool* pool;
+    {
+        std::unique_lock lock{mutex};
+        auto& p = pools[rules.string()];
+        if (not p) p = std::make_unique<Pool>();
+        pool = p.get();
+    }
+
+    {
+        std::unique_lock lock{pool->mutex};
+        if (not pool->free.empty()) {
+            auto t = std::move(pool->free.back());
+            pool->free.pop_back();
+            return Lease{pool, std::move(t)};
+        }
+    }
+
+    // Compile the rules without holding the lock.
+    return Lease{pool, std::make_unique<text::Transliterator>(rules)};
+}
+
+auto TransliteratorRegistry::Lease::operator=(Lease&& other) noexcept -> Lease& {
+    if (this == &other) return *this;
+    Release();
+    pool = std::exchange(other.pool, nullptr);
+    transliterator = std::move(other.transliterator);
+    return *this;
+}
+
+TransliteratorRegistry::Lease::~Lease() {
+    Release();
+}
+
+void TransliteratorRegistry::Lease::Release() {
+    if (not transliterator) return;
+    std::unique_lock lock{pool->mutex};
+    pool->free.push_back(std::move(transliterator));
+}
@@ -1,67 +1,109 @@
 #include <dictgen/backends.hh>
+#include <dictgen/scan.hh>
 
 using namespace dict;
 
-struct TypstBackend::Renderer : dict::Renderer {
+template <bool StripFormatting>
+struct TypstBackend::Renderer final : dict::Renderer<Renderer<StripFormatting>> {
     TypstBackend& backend;
-    const bool raw_text;
-    Renderer(TypstBackend& backend, bool strip_formatting)
-        : backend(backend), raw_text(strip_formatting) {}
+    explicit Renderer(TypstBackend& backend) : backend(backend) {}
 
-    void render_macro(const MacroNode& n) override;
+    bool begin_macro(Macro m) override;
+    void end_macro(Macro m) override;
     void render_text(str text) override;
     void render_formatting(str formatting) override;
 };
 
-void TypstBackend::Renderer::render_macro(const MacroNode& n) {
-    if (raw_text) return;
+template <bool StripFormatting>
+bool TypstBackend::Renderer<StripFormatting>::begin_macro(Macro m) {
+    if constexpr (StripFormatting) return false;
+    auto& out = this->out;
+
     // Use #text rather than ** or __ because it nests properly (#text can reset
     // another #text but not ** o __).
-    switch (n.macro) {
-        case Macro::Bold: out += "#text(weight: \"bold\")["; break;
-        case Macro::Ellipsis: out += "..."; return;
-        case Macro::Italic: out += "#text(style: \"italic\")["; break;
-        case Macro::Lemma: out += "#lemma["; break;
-        case Macro::Normal: out += "#text(style: \"normal\", weight: \"regular\")["; break;
-        case Macro::ParagraphBreak: out += "#parbreak()"; return;
-        case Macro::Sense: out += "#sense["; break;
-        case Macro::SmallCaps: out += "#smallcaps["; break;
-        case Macro::Subscript: out += "#sub["; break;
-        case Macro::Superscript: out += "#super["; break;
-        case Macro::SoftHyphen: out += "-?"; return;
+    switch (m) {
+        case Macro::Bold: out += "#text(weight: \"bold\")["; return true;
+        case Macro::Ellipsis: out += "..."; return false;
+        case Macro::Italic: out += "#text(style: \"italic\")["; return true;
+        case Macro::Lemma: out += "#lemma["; return true;
+        case Macro::Normal: out += "#text(style: \"normal\", weight: \"regular\")["; return true;
+        case Macro::ParagraphBreak: out += "#parbreak()"; return false;
+        case Macro::Sense: out += "#sense["; return true;
+        case Macro::SmallCaps: out += "#smallcaps["; return true;
+        case Macro::Subscript: out += "#sub["; return true;
+        case Macro::Superscript: out += "#super["; return true;
+        case Macro::SoftHyphen: out += "-?"; return false;
         case Macro::This:
             if (backend.current_word.empty()) backend.error("'\\this' is not allowed here");
             out += backend.current_word;
-            return;
+            return false;
     }
 
-    render(n.args);
-    out += "]";
+    Unreachable("Invalid macro");
+}
+
+template <bool StripFormatting>
+void TypstBackend::Renderer<StripFormatting>::end_macro(Macro) {
+    this->out += "]";
 }
 
-void TypstBackend::Renderer::render_text(str text) {
-    out += text.escape("*_`<@=-+/\\#$");
+template <bool StripFormatting>
+void TypstBackend::Renderer<StripFormatting>::render_text(str text) {
+    EscapeMarkup(this->out, text);
 }
 
-void TypstBackend::Renderer::render_formatting(str formatting) {
-    if (raw_text) return;
-    dict::Renderer::render_formatting(formatting);
+template <bool StripFormatting>
+void TypstBackend::Renderer<StripFormatting>::render_formatting(str formatting) {
+    if constexpr (StripFormatting) return;
+    this->out += formatting;
+}
+
+// Copy runs of text that don’t need to be escaped in one go.
+void TypstBackend::EscapeMarkup(std::string& out, str text) {
+    auto find = scan::Best().find_typst_escape;
+    auto data = text.data();
+    auto size = text.size();
+    usz start = 0;
+    for (usz i = find(data, size); i != size; i = start + find(data + start, size - start)) {
+        out.append(data + start, i - start);
+        out += '\\';
+        out += data[i];
+        start = i + 1;
+    }
+
+    out.append(data + start, size - start);
 }
 
 auto TypstBackend::convert(str input, bool strip_macros) -> std::string {
-    auto res = TexParser::Parse(*this, input);
+    defer { arena.reset(); };
+    auto Render = [&](auto r) -> std::string {
+        ProfileScope _{profiler, Phase::Render};
+        auto res = TexParser::Render(*this, input, r);
+        if (not res.has_value()) {
+            error("{}", res.error());
+            return "";
+        }
+        return std::move(r.out);
+    };
+
+    return strip_macros ? Render(Renderer<true>{*this}) : Render(Renderer<false>{*this});
+}
+
+auto TypstBackend::convert_and_strip(str input) -> std::pair<std::string, std::string> {
+    defer { arena.reset(); };
+    ProfileScope _{profiler, Phase::Render};
+    DualRenderer r{Renderer<false>{*this}, Renderer<true>{*this}};
+    auto res = TexParser::Render(*this, input, r);
     if (not res.has_value()) {
         error("{}", res.error());
-        return "";
+        return {};
     }
-
-    Renderer r{*this, strip_macros};
-    r.render(*res.value());
-    return std::move(r.out);
+    return {std::move(r.first.out), std::move(r.second.out)};
 }
 
 void TypstBackend::emit(str word, const RefEntry& data) {
-    output += std::format(
+    std::format_to(
+        std::back_inserter(output),
         "#dictionary-reference([{}], [{}])\n",
         convert(word),
         convert(data)
@@ -80,7 +122,8 @@ void TypstBackend::emit(str word, const FullEntry& data) {
         );
 
         for (const auto& e : s.examples) {
-            sense += std::format(
+            std::format_to(
+                std::back_inserter(sense),
                 "(text: [{}], comment: [{}]),",
                 convert(e.text),
                 convert(e.comment)
@@ -91,14 +134,16 @@ void TypstBackend::emit(str word, const FullEntry& data) {
         return sense;
     };
 
-    auto ipa = ops.to_ipa(convert(word, true));
+    auto [formatted_word, stripped_word] = convert_and_strip(word);
+    auto ipa = to_ipa(stripped_word);
     if (not ipa.has_value()) {
         error("Failed to convert '{}' to IPA: {}", word, ipa.error());
         ipa = "ERROR";
     }
 
-    current_word = convert(word);
-    output += std::format(
+    current_word = std::move(formatted_word);
+    std::format_to(
+        std::back_inserter(output),
         "#dictionary-entry((word: [{}], pos: [{}], etym: [{}], forms: [{}], ipa: [{}], prim_def: {}, senses: ({})))\n",
         current_word,
         convert(data.pos),
@@ -115,6 +160,44 @@ void TypstBackend::emit_error(std::string error) {
     if (not errors.ends_with('\n')) errors += "\n";
 }
 
+auto TypstBackend::fork() -> std::unique_ptr<Backend> {
+    return New<TypstBackend>(ops);
+}
+
+void TypstBackend::join(Backend& b) {
+    auto& fork = static_cast<TypstBackend&>(b);
+    has_error |= std::exchange(fork.has_error, false);
+    output += std::move(fork.output);
+    errors += std::move(fork.errors);
+    fork.output.clear();
+    fork.errors.clear();
+}
+
+// We always convert the headword with formatting stripped. Don’t report
+// errors here; we’ll do that when we emit the entry.
+auto TypstBackend::ipa_source(str word, const FullEntry&) -> std::optional<std::string> {
+    defer { arena.reset(); };
+    Renderer<true> r{*this};
+    if (not TexParser::Render(*this, word, r).has_value()) return std::nullopt;
+    return std::move(r.out);
+}
+
+auto TypstBackend::cache_tag() const -> std::string {
+    return "typst";
+}
+
+auto TypstBackend::take_fragment() -> std::optional<std::string> {
+    auto fragment = std::move(output);
+    output.clear();
+    errors.clear();
+    if (std::exchange(has_error, false)) return std::nullopt;
+    return fragment;
+}
+
+void TypstBackend::splice(str fragment) {
+    output += fragment;
+}
+
 void TypstBackend::finish() {
     if (has_error) {
         output = "#panic(\"Dictionary generator has errors\")\n";
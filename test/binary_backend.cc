@@ -0,0 +1,198 @@
+#include <dictgen/backends.hh>
+#include <dictgen/binary.hh>
+#include <dictgen/frontend.hh>
+#include <catch2/catch_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <deque>
+#include <fstream>
+
+using namespace dict;
+
+namespace {
+struct TestOps : LanguageOps {
+    [[nodiscard]] auto to_ipa(str s) -> Result<std::string> override {
+        return std::format("/{}/", s);
+    }
+};
+}
+
+static constexpr str Input = R"(
+b|v.||To \s{bring} to life\\ bring again \ex \this{} is an example \comment with a comment|pl. \w{bs}|ipa
+a|n.|\w{ancient}|just a \textit{definition} of a \comment <comment> & stuff
+c > a, b
+d|||\\ life \\ two of them \ex one \ex two
+e > \w{a}
+Ábc d|||x
+a|adj.||another a
+)";
+
+static auto Emit(Backend& backend, usz threads = 1) -> EmitResult {
+    Generator gen{backend, threads};
+    gen.parse(Input);
+    return gen.emit_to_string();
+}
+
+/// Convert a binary dictionary to the same JSON that the JSON backend emits.
+static auto ToJson(const BinaryDictionary& dict) -> json {
+    auto String = [](Result<str> s) { return s.value().string(); };
+    auto SenseToJson = [&](const BinaryDictionary::Sense& s) {
+        json j;
+        if (auto c = s.comment().value()) j["comment"] = c->string();
+        j["def"] = String(s.def());
+        for (auto ex : s.examples().value()) {
+            json e;
+            if (auto c = ex.comment().value()) e["comment"] = c->string();
+            e["text"] = String(ex.text());
+            j["examples"].push_back(e);
+        }
+        return j;
+    };
+
+    json j;
+    j["entries"] = json::array();
+    j["refs"] = json::array();
+    for (usz i = 0; i < dict.entry_count(); i++) {
+        auto e = dict.entry(i);
+        json entry;
+        if (auto def = e.def().value()) entry["def"] = SenseToJson(*def);
+        entry["def-search"] = String(e.def_search());
+        if (auto etym = e.etym().value()) entry["etym"] = etym->string();
+        if (auto forms = e.forms().value()) entry["forms"] = forms->string();
+        entry["hw-search"] = String(e.hw_search());
+        entry["ipa"] = String(e.ipa());
+        entry["pos"] = String(e.pos());
+        for (auto s : e.senses().value()) entry["senses"].push_back(SenseToJson(s));
+        entry["word"] = String(e.word());
+        j["entries"].push_back(entry);
+    }
+
+    for (usz i = 0; i < dict.ref_count(); i++) {
+        auto r = dict.ref(i);
+        j["refs"].push_back(json{
+            {"from", String(r.from())},
+            {"from-search", String(r.from_search())},
+            {"to", String(r.to())},
+        });
+    }
+
+    return j;
+}
+
+TEST_CASE("Binary backend: Round trip matches JSON output") {
+    TestOps ops;
+    JsonBackend json_backend{ops, false};
+    BinaryBackend binary_backend{ops};
+    auto expected = Emit(json_backend);
+    auto res = Emit(binary_backend);
+    REQUIRE(not expected.has_error);
+    REQUIRE(not res.has_error);
+
+    auto dict = BinaryDictionary::Load(res.backend_output);
+    REQUIRE(dict.has_value());
+    CHECK(dict.value().entry_count() == 5);
+    CHECK(dict.value().ref_count() == 2);
+    CHECK(ToJson(dict.value()) == json::parse(expected.backend_output));
+
+    // Parallel emission produces the same file.
+    for (usz threads : {2, 4}) {
+        BinaryBackend parallel{ops};
+        CHECK(Emit(parallel, threads).backend_output == res.backend_output);
+    }
+}
+
+TEST_CASE("Binary backend: Lookup") {
+    TestOps ops;
+    BinaryBackend backend{ops};
+    auto res = Emit(backend);
+    REQUIRE(not res.has_error);
+
+    // Write it to a file to make sure that memory-mapping it works.
+    auto path = std::filesystem::temp_directory_path() / "dictgen-test-binary-lookup";
+    {
+        std::ofstream f{path, std::ios::binary | std::ios::trunc};
+        f << res.backend_output;
+    }
+
+    auto dict = BinaryDictionary::Open(path);
+    REQUIRE(dict.has_value());
+    auto& d = dict.value();
+
+    // Homonyms are all returned, in collation order.
+    auto a = d.lookup("a").value();
+    REQUIRE(a.size() == 2);
+    CHECK(std::get<BinaryDictionary::Entry>(a[0]).pos() == "n.");
+    CHECK(std::get<BinaryDictionary::Entry>(a[1]).pos() == "adj.");
+
+    // Lookups use the headword without formatting.
+    auto abc = d.lookup("Ábc d").value();
+    REQUIRE(abc.size() == 1);
+    CHECK(std::get<BinaryDictionary::Entry>(abc[0]).def().value()->def() == "x");
+
+    auto c = d.lookup("c").value();
+    REQUIRE(c.size() == 1);
+    CHECK(std::get<BinaryDictionary::Ref>(c[0]).to() == "a, b");
+
+    CHECK(d.lookup("").value().empty());
+    CHECK(d.lookup("ab").value().empty());
+    CHECK(d.lookup("zzz").value().empty());
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Binary backend: Reject invalid files") {
+    TestOps ops;
+    BinaryBackend backend{ops};
+    auto res = Emit(backend);
+    REQUIRE(not res.has_error);
+
+    CHECK(not BinaryDictionary::Load("").has_value());
+    CHECK(not BinaryDictionary::Load(res.backend_output.substr(0, sizeof(binary::Header) - 1)).has_value());
+
+    auto bad_magic = res.backend_output;
+    bad_magic[0] = 'X';
+    CHECK(not BinaryDictionary::Load(bad_magic).has_value());
+
+    auto bad_version = res.backend_output;
+    bad_version[4] = char(binary::Version + 1);
+    CHECK(not BinaryDictionary::Load(bad_version).has_value());
+
+    auto truncated = res.backend_output;
+    truncated.pop_back();
+    CHECK(not BinaryDictionary::Load(truncated).has_value());
+
+    // Records are only checked when they are accessed, so a corrupt record
+    // doesn’t prevent the file from being loaded.
+    binary::Header h;
+    std::memcpy(&h, res.backend_output.data(), sizeof(h));
+    REQUIRE(h.entry_count > 0);
+    REQUIRE(h.example_count > 0);
+    std::deque<std::string> buffers;
+    auto Corrupt = [&]<typename T>(u32 table, usz i, auto modify) {
+        auto& data = buffers.emplace_back(res.backend_output);
+        T rec;
+        std::memcpy(&rec, data.data() + table + i * sizeof(T), sizeof(T));
+        modify(rec);
+        std::memcpy(data.data() + table + i * sizeof(T), &rec, sizeof(T));
+        auto dict = BinaryDictionary::Load(data);
+        REQUIRE(dict.has_value());
+        return std::move(dict.value());
+    };
+
+    auto unchanged = Corrupt.operator()<binary::Entry>(h.entries, 0, [](auto&) {});
+    CHECK(ToJson(unchanged) == ToJson(BinaryDictionary::Load(res.backend_output).value()));
+
+    auto last = h.entry_count - 1;
+    binary::IndexRecord first_key;
+    std::memcpy(&first_key, res.backend_output.data() + h.index, sizeof(first_key));
+    auto key = res.backend_output.substr(h.strings + first_key.key.offset, first_key.key.size);
+
+    CHECK(not Corrupt.operator()<binary::Entry>(h.entries, 0, [&](auto& e) { e.word.offset = h.strings_size; e.word.size = 1; }).entry(0).word().has_value());
+    CHECK(not Corrupt.operator()<binary::Entry>(h.entries, 0, [](auto& e) { e.pos.offset = binary::StringRef::Absent; }).entry(0).pos().has_value());
+    CHECK(not Corrupt.operator()<binary::Entry>(h.entries, 0, [&](auto& e) { e.def = h.sense_count; }).entry(0).def().has_value());
+    CHECK(not Corrupt.operator()<binary::Entry>(h.entries, 0, [&](auto& e) { e.sense_count = h.sense_count - e.first_sense + 1; }).entry(0).senses().has_value());
+    CHECK(not Corrupt.operator()<binary::Entry>(h.entries, last, [](auto& e) { e.first_sense = ~u32(0); e.sense_count = 2; }).entry(last).senses().has_value());
+    CHECK(not Corrupt.operator()<binary::Sense>(h.senses, 0, [&](auto& s) { s.example_count = h.example_count + 1; }).sense(0).examples().has_value());
+    CHECK(not Corrupt.operator()<binary::Example>(h.examples, 0, [](auto& ex) { ex.text.size = ~u32(0); }).example(0).text().has_value());
+    CHECK(not Corrupt.operator()<binary::Ref>(h.refs, 0, [&](auto& r) { r.to.offset = h.strings_size + 1; r.to.size = 0; }).ref(0).to().has_value());
+    CHECK(not Corrupt.operator()<binary::IndexRecord>(h.index, 0, [&](auto& r) { r.element = r.is_ref ? h.ref_count : h.entry_count; }).lookup(key).has_value());
+    CHECK(not Corrupt.operator()<binary::IndexRecord>(h.index, 0, [&](auto& r) { r.key.offset = h.strings_size; }).lookup(key).has_value());
+}
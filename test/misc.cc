@@ -2,6 +2,13 @@
 #include <catch2/catch_test_macros.hpp>
 #include <dictgen/frontend.hh>
 #include <dictgen/backends.hh>
+#include <base/Trie.hh>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
 
 using namespace dict;
 
@@ -13,30 +20,52 @@ struct TestOps : LanguageOps {
 };
 }
 
-static auto Emit(str input) -> EmitResult {
+static auto Emit(str input, usz threads = 1, bool minify = false) -> EmitResult {
     TestOps ops;
-    JsonBackend backend{ops, false};
-    Generator gen{backend};
+    JsonBackend backend{ops, minify};
+    Generator gen{backend, threads};
     gen.parse(input);
     return gen.emit_to_string();
 }
 
 static void CheckContains(str input, const std::string& substr) {
-    auto [output, has_error] = Emit(input);
-    CHECK(not has_error);
-    CHECK_THAT(std::string(str(output).trim()), Catch::Matchers::ContainsSubstring(substr));
+    auto res = Emit(input);
+    CHECK(not res.has_error);
+    CHECK_THAT(std::string(str(res.backend_output).trim()), Catch::Matchers::ContainsSubstring(substr));
 }
 
 static void CheckExact(str input, str expected) {
-    auto [output, has_error] = Emit(input);
-    CHECK(not has_error);
-    CHECK(std::string(str(output).trim()) == std::string(expected.trim()));
+    auto res = Emit(input);
+    CHECK(not res.has_error);
+    CHECK(std::string(str(res.backend_output).trim()) == std::string(expected.trim()));
+}
+
+/// Check that emitting on several threads and with an output cache
+/// produces the same output as emitting on a single thread without one.
+/// 'emit' takes a thread count and an optional cache and returns the
+/// output; 'name' identifies the cache file.
+template <typename EmitFn>
+static void CheckParallelAndCached(str name, EmitFn emit) {
+    auto expected = emit(1, nullptr);
+    for (usz threads : {2, 4}) CHECK(emit(threads, nullptr) == expected);
+
+    auto path = std::filesystem::temp_directory_path() / std::format("dictgen-test-{}-cache", name);
+    std::filesystem::remove(path);
+    for (usz threads : {1, 4}) {
+        for (int run = 0; run < 2; run++) {
+            auto cache = OutputCache::Load(path);
+            CHECK(emit(threads, &cache) == expected);
+            REQUIRE(cache.save(path));
+        }
+    }
+
+    std::filesystem::remove(path);
 }
 
 static void CheckError(str input, const std::string& substr) {
-    auto [output, has_error] = Emit(input);
-    CHECK(has_error);
-    CHECK(std::string(str(output).trim()) == substr);
+    auto res = Emit(input);
+    CHECK(res.has_error);
+    CHECK(std::string(str(res.backend_output).trim()) == substr);
 }
 
 TEST_CASE("JSON backend: Disallow \\comment and \\ex if the definition is empty") {
@@ -72,6 +101,59 @@ TEST_CASE("JSON backend: search normalisation") {
     CHECK(J.NormaliseForSearch("®©™@ç") == "rctmc");
     CHECK(J.NormaliseForSearch("ḍriłv́ẹ́âǎ") == "drilveaa");
     CHECK(J.NormaliseForSearch("+-/*!?\"$%&'()[]{},._^`<>:;=~\\@") == "");
+
+    // The ASCII fast path must match the transliterator exactly.
+    static constexpr str Inputs[]{
+        "",
+        " ",
+        "abcd",
+        "  a  bc'' ' ..-d-",
+        "To \\s{bring} to life; (archaic) bring, BRING!",
+        "sbd./sth.",
+        "do sbd./sth. a favour",
+        "sbd./sth. first",
+        "last sbd./sth.",
+        "asbdsthb sbdsbdsthsth xsbdsth",
+        "sbdsth",
+        "tab\tseparated\nlines\r\n and 123 digits",
+        "x  y   z x y",
+        "Zz zZ aA Aa",
+        "\x01\x7f~`@[{",
+    };
+
+    for (auto in : Inputs) {
+        INFO(in);
+        CHECK(J.NormaliseAsciiForSearch(in) == J.NormaliseForSearchGeneric(in));
+    }
+
+    // Also check some random ASCII.
+    u64 state = 42;
+    for (usz i = 0; i < 1'000; i++) {
+        std::string in;
+        for (usz j = 0, n = i % 40; j < n; j++) {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            static constexpr str Alphabet = "sbdth  aZ.-/'\t{}1";
+            in += Alphabet[usz(state >> 33) % Alphabet.size()];
+        }
+
+        INFO(in);
+        CHECK(J.NormaliseAsciiForSearch(in) == J.NormaliseForSearchGeneric(in));
+    }
+
+    // Inputs that consist only of letters and single spaces fill the
+    // entire word buffer; make them too long for the small string
+    // optimisation.
+    CHECK(J.NormaliseAsciiForSearch("abcdefghij abcdefghij abcdefghij") == "abcdefghij");
+    for (usz words : {2, 3, 7, 50}) {
+        std::string in;
+        for (usz i = 0; i < words; i++) {
+            if (i) in += ' ';
+            in += std::string(10 + i % 3, char('a' + (i * 7) % 26));
+        }
+
+        INFO(in);
+        CHECK(J.NormaliseAsciiForSearch(in) == J.NormaliseForSearchGeneric(in));
+    }
 }
 
 TEST_CASE("Bogus entries") {
@@ -185,3 +267,650 @@ TEST_CASE("JSON Backend: Format \\this as a word") {
 }
 )json");
 }
+
+TEST_CASE("Parallel parsing produces the same output as serial parsing") {
+    static constexpr str Input = R"(
+b|||b\\ b2\ex b3
+a|||a
+    continued
+$backend tex
+x|||only in tex
+$backend all
+\\c|||c
+d > a, b
+$foo
+foo
+e|||\ex e
+f|||\s{f}
+)";
+
+    auto serial = Emit(Input);
+    CHECK(serial.has_error);
+    for (usz threads : {2, 3, 8, 64}) {
+        auto parallel = Emit(Input, threads);
+        CHECK(parallel.has_error == serial.has_error);
+        CHECK(parallel.backend_output == serial.backend_output);
+    }
+
+    static constexpr str Valid = "b|||b\na|||a\n  continued\nc > a, b\nd|||\\s{d}\\\\ d2 \\ex d3";
+    auto ok = Emit(Valid);
+    CHECK(not ok.has_error);
+    CHECK(Emit(Valid, 4).backend_output == ok.backend_output);
+}
+
+TEST_CASE("JSON Backend: Streamed output matches nlohmann::json") {
+    static constexpr str Input = R"(
+b|v.|"quoted"|To \s{bring} to life\\ sense \comment with comment \ex example \comment ex comment \ex another|forms|ipa
+a|n.||just a \textit{definition}
+    \\ second sense
+c > a, b
+d|||\\ only senses \\ two of them
+e > \w{a}
+)";
+
+    for (usz threads : {1, 4}) {
+        auto res = Emit(Input, threads);
+        REQUIRE(not res.has_error);
+        CHECK(json::parse(res.backend_output).dump(4) == res.backend_output);
+
+        auto minified = Emit(Input, threads, true);
+        REQUIRE(not minified.has_error);
+        CHECK(json::parse(minified.backend_output).dump() == minified.backend_output);
+    }
+
+    CHECK(Emit("").backend_output == json::parse(Emit("").backend_output).dump(4));
+    CHECK(Emit("", 1, true).backend_output == R"({"entries":[],"refs":[]})");
+    CHECK(Emit("a > b", 1, true).backend_output == R"({"entries":[],"refs":[{"from":"a","from-search":"a","to":"b"}]})");
+}
+
+TEST_CASE("JSON Backend: Search terms are computed from the text, not the HTML") {
+    CHECK(
+        Emit("rock \\& roll~ > music", 1, true).backend_output ==
+        R"({"entries":[],"refs":[{"from":"rock &amp; roll&nbsp;","from-search":"rock roll","to":"music"}]})"
+    );
+}
+
+TEST_CASE("Output cache produces the same output as a full rebuild") {
+    static constexpr str Before = "b|||b\\\\ b2 \\ex \\this\na|||\\s{a}\nc > a, b\nd|||d";
+    static constexpr str After = "b|||b\\\\ b2 \\ex \\this\na|||\\s{a} changed\nc > a, b\ne|||e\nf|||\\ex error";
+    auto path = std::filesystem::temp_directory_path() / "dictgen-test-output-cache";
+    std::filesystem::remove(path);
+
+    auto EmitCached = [&](str input, usz threads) {
+        TestOps ops;
+        JsonBackend backend{ops, false};
+        Generator gen{backend, threads};
+        auto cache = OutputCache::Load(path);
+        gen.use_cache(cache);
+        gen.parse(input);
+        auto res = gen.emit_to_string();
+        REQUIRE(cache.save(path));
+        return std::pair{res, cache.size()};
+    };
+
+    for (usz threads : {1, 4}) {
+        std::filesystem::remove(path);
+        auto [cold, cold_size] = EmitCached(Before, threads);
+        CHECK(cold_size == 4);
+        CHECK(cold.backend_output == Emit(Before).backend_output);
+
+        auto [warm, warm_size] = EmitCached(Before, threads);
+        CHECK(warm_size == 4);
+        CHECK(warm.backend_output == cold.backend_output);
+
+        // Entries that have errors are not cached, and unused entries are dropped.
+        auto [changed, changed_size] = EmitCached(After, threads);
+        CHECK(changed.has_error);
+        CHECK(changed_size == 4);
+        CHECK(changed.backend_output == Emit(After).backend_output);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Default sort keys order entries the same way as collate()") {
+    struct SortKeyOps : TestOps {
+        auto sort_key(str32 word, str32 nfkd) -> std::optional<std::string> override {
+            return DefaultSortKey(word, nfkd);
+        }
+    };
+
+    static constexpr str Input = "ab|||x\nb|||x\nÁ|||x\na|||x\nA|||x\nab > a\naa|||x\nâb|||x\nz > a\na-b|||x\nB|||x\nab|||y";
+    auto EmitWith = [](LanguageOps& ops) {
+        JsonBackend backend{ops, false};
+        Generator gen{backend};
+        gen.parse(Input);
+        return gen.emit_to_string();
+    };
+
+    TestOps ops;
+    SortKeyOps key_ops;
+    auto expected = EmitWith(ops);
+    auto actual = EmitWith(key_ops);
+    CHECK(not actual.has_error);
+    CHECK(actual.backend_output == expected.backend_output);
+}
+
+TEST_CASE("parse_file() produces the same output as parse()") {
+    static constexpr str Input = "b|||b\\\\ b2\na|||a  with\tspaces\n    continued\n\nc > a, b\n$foo\nd|||\\ex d";
+    auto path = std::filesystem::temp_directory_path() / "dictgen-test-parse-file.txt";
+    {
+        std::ofstream f{path, std::ios::binary};
+        f << Input;
+    }
+
+    TestOps ops;
+    JsonBackend backend{ops, false};
+    Generator gen{backend};
+    REQUIRE(gen.parse_file(path));
+    auto res = gen.emit_to_string();
+    auto expected = Emit(Input);
+    CHECK(res.has_error == expected.has_error);
+    CHECK(res.backend_output == expected.backend_output);
+
+    // Empty files are fine too.
+    {
+        std::ofstream f{path, std::ios::binary | std::ios::trunc};
+    }
+
+    JsonBackend empty_backend{ops, false};
+    Generator empty_gen{empty_backend};
+    REQUIRE(empty_gen.parse_file(path));
+    CHECK(empty_gen.emit_to_string().backend_output == Emit("").backend_output);
+
+    std::filesystem::remove(path);
+    JsonBackend missing_backend{ops, false};
+    Generator missing_gen{missing_backend};
+    CHECK(not missing_gen.parse_file(path));
+}
+
+TEST_CASE("Per-phase timings are recorded in EmitResult") {
+    static constexpr str Input = "b|||b \\\\ \\s{b2} \\ex ex\na|||a||/a/\nc > a";
+    for (usz threads : {1, 4}) {
+        auto res = Emit(Input, threads);
+        REQUIRE(not res.has_error);
+
+        auto& p = res.profile;
+        auto profile = json::parse(p.to_json());
+        CHECK(profile.size() == usz(+Phase::Count));
+        CHECK(profile["tex-parse"]["calls"] == p[Phase::TexParse].calls);
+        if constexpr (not Profile::Enabled) {
+            for (auto& s : p.phases) CHECK(s.calls == 0);
+            continue;
+        }
+
+        CHECK(p[Phase::Parse].calls == 1);
+        CHECK(p[Phase::Sort].calls == 1);
+        CHECK(p[Phase::Emit].calls == 1);
+        CHECK(p[Phase::Preprocess].calls == 2);
+        CHECK(p[Phase::SplitSenses].calls == 2);
+        CHECK(p[Phase::ToIPA].calls == 1);
+        CHECK(p[Phase::NormaliseForSearch].calls == 5);
+        CHECK(p[Phase::Serialise].calls == 3);
+        // Fields are rendered in a single pass, so nothing builds a tree here.
+        CHECK(p[Phase::TexParse].calls == 0);
+        CHECK(p[Phase::Render].calls > 0);
+        CHECK(p[Phase::Emit].time.count() > 0);
+    }
+}
+
+TEST_CASE("IPA cache avoids calling to_ipa() again") {
+    struct CountingOps : TestOps {
+        std::atomic<usz> calls = 0;
+        std::string version = "v1";
+        auto version_tag() -> std::string override { return version; }
+        auto to_ipa(str s) -> Result<std::string> override {
+            calls++;
+            if (s == "bad") return Error("bad word");
+            return TestOps::to_ipa(s);
+        }
+    };
+
+    static constexpr str Input = "b|||b\na|||a\nc|||c||/given/\nbad|||x\nd > a";
+    auto path = std::filesystem::temp_directory_path() / "dictgen-test-ipa-cache";
+    std::filesystem::remove(path);
+
+    CountingOps ops;
+    auto EmitCached = [&](usz threads) {
+        JsonBackend backend{ops, false};
+        Generator gen{backend, threads};
+        auto cache = IpaCache::Load(path, ops.version_tag());
+        gen.use_ipa_cache(cache);
+        gen.parse(Input);
+        auto res = gen.emit_to_string();
+        REQUIRE(cache.save(path));
+        return std::pair{res, cache.size()};
+    };
+
+    CountingOps uncached_ops;
+    JsonBackend uncached_backend{uncached_ops, false};
+    Generator uncached{uncached_backend};
+    uncached.parse(Input);
+    auto expected = uncached.emit_to_string();
+    REQUIRE(expected.has_error);
+
+    for (usz threads : {1, 4}) {
+        std::filesystem::remove(path);
+        ops.calls = 0;
+
+        // Errors are not cached, and user-provided IPA never hits the cache.
+        auto [cold, cold_size] = EmitCached(threads);
+        CHECK(cold.backend_output == expected.backend_output);
+        CHECK(cold_size == 2);
+        CHECK(ops.calls == 3);
+
+        auto [warm, warm_size] = EmitCached(threads);
+        CHECK(warm.backend_output == expected.backend_output);
+        CHECK(warm_size == 2);
+        CHECK(ops.calls == 4);
+
+        // Changing the version tag invalidates the cache.
+        ops.version = "v2";
+        auto [changed, changed_size] = EmitCached(threads);
+        CHECK(changed.backend_output == expected.backend_output);
+        CHECK(changed_size == 2);
+        CHECK(ops.calls == 7);
+        ops.version = "v1";
+    }
+
+    // Backends don’t keep pointers into a generator that is gone.
+    JsonBackend backend{ops, false};
+    {
+        Generator gen{backend};
+        auto cache = IpaCache::Load(path, ops.version_tag());
+        gen.use_ipa_cache(cache);
+        gen.parse(Input);
+        CHECK(gen.emit_to_string().backend_output == expected.backend_output);
+        CHECK(backend.precomputed_ipa != nullptr);
+    }
+
+    CHECK(backend.profiler == nullptr);
+    CHECK(backend.precomputed_ipa == nullptr);
+    CHECK(backend.ipa_cache == nullptr);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("to_ipa_batch() is used to convert headwords before emission") {
+    struct BatchOps : TestOps {
+        std::atomic<usz> single = 0, batched = 0, batches = 0;
+        auto to_ipa(str s) -> Result<std::string> override {
+            single++;
+            return TestOps::to_ipa(s);
+        }
+
+        auto to_ipa_batch(std::span<const str> words) -> std::vector<Result<std::string>> override {
+            batches++;
+            batched += words.size();
+            return words | vws::transform([](str w) -> Result<std::string> {
+                if (w == "bad") return Error("bad word");
+                return std::format("/{}/", w);
+            }) | rgs::to<std::vector>();
+        }
+    };
+
+    static constexpr str Input = "b|||b\na|||a\nc|||c||/given/\n\\s{d}|||d\nb|||again\ne > a\nbad|||x";
+    for (usz threads : {1, 2, 8}) {
+        BatchOps ops;
+        JsonBackend backend{ops, false};
+        Generator gen{backend, threads};
+        gen.parse(Input);
+        auto res = gen.emit_to_string();
+
+        // Duplicate words and words with explicit IPA are not converted.
+        CHECK(ops.single == 0);
+        CHECK(ops.batched == 4);
+        CHECK(ops.batches == std::min<usz>(threads, 4));
+        CHECK(res.has_error);
+        CHECK_THAT(res.backend_output, Catch::Matchers::StartsWith("In Line 7: Could not convert 'bad' to IPA:"));
+    }
+
+    // Without errors, the output is the same as if we’d called to_ipa().
+    BatchOps ops;
+    JsonBackend backend{ops, false};
+    Generator gen{backend, 4};
+    gen.parse("b|||b\na|||a\n\\s{d}|||d");
+    CHECK(gen.emit_to_string().backend_output == Emit("b|||b\na|||a\n\\s{d}|||d").backend_output);
+}
+
+TEST_CASE("Transliterators are compiled once and reused") {
+    static constexpr str Rules = "NFKD; [:M:] Remove; NFC; Lower;";
+    text::Transliterator* first;
+    {
+        auto a = TransliteratorRegistry::Acquire(Rules);
+        first = &*a;
+        CHECK((*a)(str32(U"ÁbÇ")) == U"abc");
+    }
+
+    // A released transliterator is handed out again; concurrent
+    // users get their own.
+    auto a = TransliteratorRegistry::Acquire(Rules);
+    auto b = TransliteratorRegistry::Acquire(Rules);
+    CHECK(&*a == first);
+    CHECK(&*b != first);
+
+    // Different rules get different transliterators.
+    auto c = TransliteratorRegistry::Acquire("Lower;");
+    CHECK(&*c != first);
+    CHECK(&*c != &*b);
+}
+
+/// Dictionary for the tests of the search index and sharded output.
+static constexpr str IndexedInput = R"(
+b|v.||To \s{bring} to life\\ bring again|forms|ipa
+a|n.||just a \textit{definition} of a
+c > a, b
+d|||\\ life \\ two of them
+e > \w{a}
+Ábc d|||x
+)";
+
+TEST_CASE("JSON Backend: Search index") {
+    auto EmitIndexed = [](usz threads, bool minify, OutputCache* cache = nullptr) {
+        TestOps ops;
+        JsonBackend backend{ops, minify, true};
+        Generator gen{backend, threads};
+        if (cache) gen.use_cache(*cache);
+        gen.parse(IndexedInput);
+        return gen.emit_to_string();
+    };
+
+    auto res = EmitIndexed(1, false);
+    REQUIRE(not res.has_error);
+    CHECK(json::parse(res.backend_output).dump(4) == res.backend_output);
+
+    // Every token in a search string must map to the element it came
+    // from, and nothing else.
+    auto j = json::parse(res.backend_output);
+    auto Check = [&](const std::string& index, const std::string& array, const std::string& field) {
+        std::map<std::string, std::vector<usz>> expected;
+        for (usz i = 0; i < j[array].size(); i++) {
+            for (auto tok : str(j[array][i][field].get<std::string>()).split(" "))
+                if (not tok.empty()) expected[tok.string()].push_back(i);
+        }
+
+        std::map<std::string, std::vector<usz>> actual;
+        for (auto& [tok, deltas] : j["index"][index].items()) {
+            usz i = 0;
+            for (auto& d : deltas) actual[tok].push_back(i += d.get<usz>());
+        }
+
+        CHECK(actual == expected);
+    };
+
+    Check("hw", "entries", "hw-search");
+    Check("def", "entries", "def-search");
+    Check("from", "refs", "from-search");
+    CHECK(j["index"]["hw"]["abc"] == json::array({1}));
+    CHECK(j["index"]["def"]["of"] == json::array({0, 3}));
+    CHECK(j["index"]["from"]["c"] == json::array({0}));
+
+    // Parallel and cached emission produce the same index.
+    CheckParallelAndCached("search-index", [&](usz threads, OutputCache* cache) {
+        return EmitIndexed(threads, false, cache).backend_output;
+    });
+
+    // The index is not written unless requested.
+    CHECK(not json::parse(Emit(IndexedInput).backend_output).contains("index"));
+    CHECK(json::parse(EmitIndexed(1, true).backend_output) == j);
+}
+
+TEST_CASE("JSON Backend: Sharded output") {
+    auto EmitSharded = [](usz threads, usz size, OutputCache* cache = nullptr) {
+        TestOps ops;
+        JsonBackend backend{ops, false, true};
+        if (size) backend.shard_by_size(size);
+        else backend.shard_by_initial();
+        Generator gen{backend, threads};
+        if (cache) gen.use_cache(*cache);
+        gen.parse(IndexedInput);
+        auto res = gen.emit_to_string();
+        return std::pair{res, backend.shards()};
+    };
+
+    auto full = json::parse(Emit(IndexedInput).backend_output);
+    auto CheckShards = [&](usz size, const std::vector<std::string>& initials) {
+        auto [res, shards] = EmitSharded(1, size);
+        REQUIRE(not res.has_error);
+        REQUIRE(shards.size() == initials.size());
+        CHECK(json::parse(res.backend_output).dump(4) == res.backend_output);
+
+        // The shards together contain the same entries as the unsharded output.
+        auto manifest = json::parse(res.backend_output);
+        auto entries = json::array(), refs = json::array();
+        for (auto [i, s] : utils::enumerate(shards)) {
+            CHECK(json::parse(s.contents).dump(4) == s.contents);
+            auto shard = json::parse(s.contents);
+            auto& m = manifest["shards"][i];
+            CHECK(m["file"] == s.name);
+            CHECK(m["entries"] == shard["entries"].size());
+            CHECK(m["refs"] == shard["refs"].size());
+            CHECK(m.value("initial", "") == (size ? "" : initials[i]));
+            for (auto& e : shard["entries"]) entries.push_back(e);
+            for (auto& r : shard["refs"]) refs.push_back(r);
+        }
+
+        CHECK(entries == full["entries"]);
+        CHECK(refs == full["refs"]);
+        CHECK(manifest["index"]["hw"]["abc"] == json::array({1}));
+
+        // Parallel and cached emission produce the same shards.
+        CheckParallelAndCached("sharded", [&](usz threads, OutputCache* cache) {
+            auto [r, s] = EmitSharded(threads, size, cache);
+            return std::pair{r.backend_output, s | vws::transform(&JsonBackend::Shard::contents) | rgs::to<std::vector>()};
+        });
+
+        return manifest;
+    };
+
+    // Entries and references are interleaved in collation order: a, Ábc d, b, c, d, e.
+    auto by_initial = CheckShards(0, {"a", "b", "c", "d", "e"});
+    CHECK(by_initial["shards"][0]["first"] == "a");
+    CHECK(by_initial["shards"][0]["last"] == "Ábc d");
+
+    auto by_size = CheckShards(2, {"", "", ""});
+    CHECK(by_size["shards"][1]["first"] == "b");
+    CHECK(by_size["shards"][1]["last"] == "c");
+    CHECK(by_size["shards"][1]["entries"] == 1);
+    CHECK(by_size["shards"][1]["refs"] == 1);
+
+    // Fragments cached in one mode are never spliced into the other.
+    auto path = std::filesystem::temp_directory_path() / "dictgen-test-sharded-modes-cache";
+    std::filesystem::remove(path);
+    for (usz size : {0, 2, 0}) {
+        auto cache = OutputCache::Load(path);
+        auto [c, c_shards] = EmitSharded(1, size, &cache);
+        CHECK(json::parse(c.backend_output) == (size ? by_size : by_initial));
+        REQUIRE(cache.save(path));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("JSON Backend: Escaping HTML matches the trie-based escaper") {
+    // This is what we used to escape text with.
+    trie escaper;
+    escaper.add("<", "&lt;");
+    escaper.add(">", "&gt;");
+    escaper.add("§~", "grammar");
+    escaper.add("~", "&nbsp;");
+    escaper.add("&", "&amp;");
+
+    static constexpr str Fragments[]{"a", "text ", "<", ">", "&", "~", "§", "§~", "\xC2", "\xA7", "-", "é", "&amp;"};
+    std::mt19937 rng{42};
+    for (int i = 0; i < 20'000; i++) {
+        std::string s;
+        for (usz n = rng() % 40; n; n--) s += Fragments[rng() % std::size(Fragments)];
+        std::string out;
+        JsonBackend::EscapeHtml(out, s);
+        INFO("Input: '" << s << "'");
+        CHECK(out == escaper.replace(s));
+    }
+}
+
+TEST_CASE("Output sinks") {
+    static constexpr str Input = "b|||b \\\\ \\s{b2}\na|||a||/a/\nc > a";
+    auto expected = Emit(Input);
+    REQUIRE(not expected.has_error);
+
+    auto EmitTo = [&](OutputSink& sink) {
+        TestOps ops;
+        JsonBackend backend{ops, false};
+        Generator gen{backend};
+        gen.parse(Input);
+        return gen.emit_to(sink);
+    };
+
+    SECTION("String") {
+        StringSink sink;
+        auto res = EmitTo(sink);
+        CHECK(not res.has_error);
+        CHECK(res.backend_output.empty());
+        CHECK(sink.contents == expected.backend_output);
+    }
+
+    SECTION("File") {
+        auto path = std::filesystem::temp_directory_path() / "dictgen-test-file-sink";
+        {
+            auto sink = FileSink::Open(path);
+            REQUIRE(sink.has_value());
+            CHECK(not EmitTo(sink.value()).has_error);
+        }
+
+        std::ifstream f{path, std::ios::binary};
+        std::string contents{std::istreambuf_iterator<char>{f}, {}};
+        CHECK(contents == expected.backend_output);
+        std::filesystem::remove(path);
+    }
+
+    SECTION("File: large writes") {
+        auto path = std::filesystem::temp_directory_path() / "dictgen-test-file-sink-large";
+        std::string expected_contents;
+        {
+            auto sink = FileSink::Open(path);
+            REQUIRE(sink.has_value());
+            for (usz size : {10, 100'000, 30'000, 40'000, 1}) {
+                std::string chunk(size, char('a' + size % 26));
+                sink.value().write(chunk);
+                expected_contents += chunk;
+            }
+            CHECK(sink.value().flush().has_value());
+        }
+
+        std::ifstream f{path, std::ios::binary};
+        std::string contents{std::istreambuf_iterator<char>{f}, {}};
+        CHECK(contents == expected_contents);
+        std::filesystem::remove(path);
+    }
+
+    SECTION("Missing directory") {
+        CHECK(not FileSink::Open(std::filesystem::temp_directory_path() / "dictgen-does-not-exist" / "x").has_value());
+    }
+}
+
+TEST_CASE("emit_all() produces the same output as one generator per backend") {
+    static constexpr str Input = R"(
+b|||b\\ b2\ex b3
+a|||a
+$backend json
+j|||only in json
+k|||\bogus
+$backend tex
+t|||only in tex
+u|||\ex u
+$backend all
+c > a, b
+d|||\s{d}
+)";
+
+    auto Make = [](LanguageOps& ops) {
+        std::vector<std::unique_ptr<Backend>> backends;
+        backends.push_back(Backend::New<JsonBackend>(ops, false));
+        backends.push_back(Backend::New<TypstBackend>(ops));
+        backends.push_back(Backend::New<TeXBackend>(ops, "input"));
+        return backends;
+    };
+
+    std::vector<EmitResult> expected;
+    for (usz i = 0; i < 3; i++) {
+        TestOps ops;
+        auto backends = Make(ops);
+        Generator gen{*backends[i]};
+        gen.parse(Input);
+        expected.push_back(gen.emit_to_string());
+    }
+
+    // Diagnostics in '$backend' sections only go to the backends they’re for.
+    CHECK(expected[0].has_error);
+    CHECK(not expected[1].has_error);
+    CHECK(expected[2].has_error);
+    CHECK(not str(expected[1].backend_output).contains("only in"));
+    CHECK(str(expected[2].backend_output).contains("only in tex"));
+    CHECK(not str(expected[2].backend_output).contains("only in json"));
+
+    // Lines that none of the backends accept aren’t parsed at all.
+    {
+        TestOps ops;
+        JsonBackend json{ops, false};
+        Generator gen{json};
+        gen.parse(Input);
+        CHECK(rgs::contains(gen.entries, std::string{"j"}, &Entry::word));
+        CHECK(not rgs::contains(gen.entries, std::string{"t"}, &Entry::word));
+        CHECK(not rgs::contains(gen.entries, std::string{"u"}, &Entry::word));
+    }
+
+    // This includes fewer threads than backends, and enough threads for
+    // each backend to fork.
+    for (usz threads : {1, 2, 3, 9}) {
+        TestOps ops;
+        auto backends = Make(ops);
+        std::vector<Backend*> ptrs;
+        for (auto& b : backends) ptrs.push_back(b.get());
+        Generator gen{ptrs, threads};
+        gen.parse(Input);
+        auto results = gen.emit_all();
+        REQUIRE(results.size() == 3);
+        for (usz i = 0; i < 3; i++) {
+            CHECK(results[i].has_error == expected[i].has_error);
+            CHECK(results[i].backend_output == expected[i].backend_output);
+        }
+
+        CHECK(gen.backend_threads == threads);
+    }
+
+    // Backends that are emitted concurrently split the threads between
+    // them; the Typst backend writes to its sink while it’s emitting.
+    for (usz threads : {2, 3, 4, 9}) {
+        TestOps ops;
+        auto backends = Make(ops);
+        std::vector<Backend*> ptrs;
+        for (auto& b : backends) ptrs.push_back(b.get());
+        Generator gen{ptrs, threads};
+        gen.parse(Input);
+        std::mutex m;
+        std::set<usz> seen;
+        StringSink json, tex;
+        CallbackSink typst{[&](str) {
+            std::unique_lock _{m};
+            seen.insert(gen.backend_threads);
+        }};
+
+        std::array<OutputSink*, 3> sinks{&json, &typst, &tex};
+        auto results = gen.emit_all(sinks);
+        CHECK(not results[1].has_error);
+        CHECK(seen == std::set<usz>{threads / std::min<usz>(threads, 3)});
+    }
+
+    // Output is written to a sink per backend.
+    TestOps ops;
+    auto backends = Make(ops);
+    std::vector<Backend*> ptrs;
+    for (auto& b : backends) ptrs.push_back(b.get());
+    Generator gen{ptrs, 2};
+    gen.parse(Input);
+    StringSink json, typst, tex;
+    std::array<OutputSink*, 3> sinks{&json, &typst, &tex};
+    auto results = gen.emit_all(sinks);
+    CHECK(results[1].backend_output.empty());
+    CHECK(typst.contents == expected[1].backend_output);
+    CHECK(results[0].backend_output == expected[0].backend_output);
+    CHECK(json.contents.empty());
+}
@@ -1,12 +1,15 @@
 #include <catch2/catch_all.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <dictgen/backends.hh>
+#include <dictgen/scan.hh>
+#include <random>
 
 using namespace dict;
 
 namespace {
 struct TestOps : LanguageOps {
     auto handle_unknown_macro(TexParser&, str macro) -> Result<Node::Ptr> override;
+    void register_macros(MacroRegistry& r) override;
     [[nodiscard]] auto to_ipa(str) -> Result<std::string> override { return "[[ipa]]"; }
 };
 }
@@ -26,6 +29,15 @@ auto TestOps::handle_unknown_macro(TexParser& p, str macro) -> Result<Node::Ptr>
     return LanguageOps::handle_unknown_macro(p, macro);
 }
 
+void TestOps::register_macros(MacroRegistry& r) {
+    r.add_text("registeredtext", "<text>");
+    r.add_formatting("registeredformatting", "<b>");
+    r.add_formatting("%", "<percent>");
+    r.add("pair", 2, [](TexParser& p, std::span<const Node::Ptr> args) -> Result<Node::Ptr> {
+        return p.group(p.formatting("<pair>"), args[0], p.formatting("|"), args[1], p.formatting("</pair>"));
+    });
+}
+
 static auto Convert(str input, bool strip_macros = false) -> std::string {
     TestOps ops;
     JsonBackend j{ops, false};
@@ -35,6 +47,20 @@ static auto Convert(str input, bool strip_macros = false) -> std::string {
     return text;
 }
 
+/// Parse a tree and render it, instead of doing both in a single pass.
+static auto ConvertTree(str input, bool strip_macros = false) -> std::string {
+    TestOps ops;
+    JsonBackend j{ops, false};
+    j.current_word = "the-current-word";
+    auto res = TexParser::Parse(j, input);
+    if (not res.has_value()) throw std::runtime_error(res.error());
+    auto Render = [&](auto r) {
+        r.render(*res.value());
+        return std::move(r.out);
+    };
+    return strip_macros ? Render(JsonBackend::Renderer<true>{j}) : Render(JsonBackend::Renderer<false>{j});
+}
+
 TEST_CASE("Parse plain text") {
     CHECK(Convert("") == "");
     CHECK(Convert("aa") == "aa");
@@ -109,6 +135,69 @@ TEST_CASE("Unknown macros are passed to the lang ops") {
     CHECK_THROWS(Convert("\\definitelynotdefined"));
 }
 
+TEST_CASE("Registered macros") {
+    CHECK(Convert("\\registeredtext") == "&lt;text&gt;");
+    CHECK(Convert("a\\registeredformatting b") == "a<b>b");
+    CHECK(Convert("a\\registeredformatting b", true) == "ab");
+    CHECK(Convert("\\pair{a}{\\textit{b}}") == "<pair>a|<em>b</em></pair>");
+    CHECK(Convert("\\pair {a} {b}c") == "<pair>a|b</pair>c");
+    CHECK(Convert("\\pair{a}{b}", true) == "ab");
+    CHECK_THROWS(Convert("\\pair{a}"));
+    CHECK_THROWS(Convert("\\pair{a} b"));
+
+    // Builtin single-character macros take precedence.
+    CHECK(Convert("\\%") == "%");
+
+    // Unregistered macros still go to handle_unknown_macro().
+    CHECK(Convert("\\xyz{bar}") == "<foo>bar</foo>");
+}
+
+TEST_CASE("Single-pass rendering matches rendering a tree") {
+    static constexpr str Inputs[]{
+        "plain text",
+        "\\s{a{\\textit{b}}} \\xyz{c} text \\this ",
+        "\\textbf{\\xyz{\\Sup{a} b}}c",
+        "\\pair{\\s{x}}{y} \\registeredtext \\registeredformatting",
+        "a\\ref{\\w{b}}c\\label{d}e",
+        "$x^2$ \\& \\- \\ldots{} \\par \\/",
+        "\\comment a \\ex b {\\senseref{{c}}}",
+        "\\s{}\\textnf{\\Sub{}}",
+    };
+
+    for (auto input : Inputs) {
+        CHECK(Convert(input) == ConvertTree(input));
+        CHECK(Convert(input, true) == ConvertTree(input, true));
+    }
+}
+
+TEST_CASE("Rendering with and without formatting in one pass") {
+    static constexpr str Inputs[]{
+        "plain text",
+        "\\s{a{\\textit{b}}} \\xyz{c} text \\this ",
+        "\\textbf{\\xyz{\\Sup{a} b}}c",
+        "\\pair{\\s{x}}{y} \\registeredtext \\registeredformatting",
+        "a\\ref{\\w{b}}c\\label{d}e",
+        "$x^2$ \\& \\- \\ldots{} \\par \\/",
+    };
+
+    TestOps ops;
+    JsonBackend j{ops, false};
+    j.current_word = "the-current-word";
+    for (auto input : Inputs) {
+        auto [html, text] = j.tex_to_html_and_text(input);
+        CHECK(html == Convert(input));
+        CHECK(text == Convert(input, true));
+    }
+
+    // Errors are only reported once.
+    CHECK(not j.has_error);
+    auto [html, text] = j.tex_to_html_and_text("\\s{a");
+    CHECK(j.has_error);
+    CHECK(html.empty());
+    CHECK(text.empty());
+    CHECK(rgs::count(j.errors, '\n') == 1);
+}
+
 TEST_CASE("Single-argument macros") {
     CHECK(Convert("\\s{a}{b}") == "<f-s>a</f-s>b");
     CHECK(Convert("\\s{a{c}}{b}") == "<f-s>ac</f-s>b");
@@ -155,3 +244,90 @@ TEST_CASE("Backend Query") {
     CHECK(not TexParser(typ, "").backend_is<TeXBackend>());
     CHECK(TexParser(typ, "").backend_is<TypstBackend>());
 }
+
+TEST_CASE("Empty text nodes are not created") {
+    TestOps ops;
+    JsonBackend j{ops, false};
+    auto res = TexParser::Parse(j, "\\s{a}\\s{b}");
+    REQUIRE(res.has_value());
+    auto c = res.value()->as<ContentNode>();
+    REQUIRE(c);
+    CHECK(c->children.size() == 2);
+    CHECK(c->children[0]->is<MacroNode>());
+    CHECK(c->children[1]->is<MacroNode>());
+}
+
+TEST_CASE("The AST arena is reused across fields") {
+    TestOps ops;
+    JsonBackend j{ops, false};
+    j.current_word = "the-current-word";
+    std::string long_text;
+    for (int i = 0; i < 1'000; i++) long_text += "\\s{a{\\textit{b}}} \\xyz{c} text \\this ";
+
+    (void) j.tex_to_html(long_text);
+    auto chunks = j.arena.chunk_count();
+    CHECK(chunks != 0);
+    for (int i = 0; i < 10; i++) (void) j.tex_to_html(long_text);
+    (void) j.tex_to_html("\\s{a}");
+    CHECK(j.arena.chunk_count() == chunks);
+    CHECK(not j.has_error);
+}
+
+TEST_CASE("Arena allocations are aligned") {
+    Arena a;
+    (void) a.allocate(1, 1);
+    CHECK(reinterpret_cast<std::uintptr_t>(a.allocate(8, 8)) % 8 == 0);
+    (void) a.allocate(3, 1);
+    CHECK(reinterpret_cast<std::uintptr_t>(a.allocate(16, 16)) % 16 == 0);
+    CHECK(a.copy("foobar") == "foobar");
+}
+
+TEST_CASE("All scanning kernels agree") {
+    // Include bytes that are just outside the ranges the kernels check for.
+    static constexpr char Alphabet[]{
+        'a', 'z', 'A', 'Z', '@', '`', '[', '{', '}', '|', '\\', '$', ' ', '\x80', '\xC3', '\xFF',
+        '<', '>', '&', '~', '*', '_', '=', '-', '+', '/', '#',
+    };
+    auto impls = scan::Implementations();
+    REQUIRE(impls.front().name == "portable");
+
+    str letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ@";
+    std::mt19937 rng{42};
+    for (int i = 0; i < 20'000; i++) {
+        std::string s;
+        for (usz n = rng() % 100; n; n--) s += Alphabet[rng() % std::size(Alphabet)];
+
+        // Make sure we also test the case where we find nothing.
+        if (i % 4 == 0) std::erase_if(s, [](char c) { return str("\\${}").contains(c); });
+        if (i % 4 == 1) std::erase_if(s, [&](char c) { return not letters.contains(c); });
+
+        auto FindAny = [&](str chars) {
+            str text = s;
+            return text.take_until_any(chars).size();
+        };
+
+        auto special = FindAny("\\${}");
+        auto html = FindAny("<>&~");
+        auto typst = FindAny("*_`<@=-+/\\#$");
+        str rest = s;
+        auto macro = rest.take_while_any(letters).size();
+        for (auto& k : impls) {
+            INFO("Kernel: " << k.name << ", Input: '" << s << "'");
+            CHECK(k.find_tex_special(s.data(), s.size()) == special);
+            CHECK(k.count_macro_letters(s.data(), s.size()) == macro);
+            CHECK(k.find_html_escape(s.data(), s.size()) == html);
+            CHECK(k.find_typst_escape(s.data(), s.size()) == typst);
+        }
+    }
+}
+
+TEST_CASE("TeX conversion benchmark", "[.][benchmark]") {
+    TestOps ops;
+    JsonBackend j{ops, false};
+    j.current_word = "the-current-word";
+    static constexpr str Field = "To \\s{bring} to life, \\textit{animate} (+\\s{acc}); see \\w{foo}\\ldots{} "
+                                 "or \\xyz{bar} for \\this and \\textbf{more} text {that} has \\- some macros.";
+
+    BENCHMARK("tex_to_html") { return j.tex_to_html(Field); };
+    BENCHMARK("tex_to_html (stripped)") { return j.tex_to_html(Field, true); };
+}
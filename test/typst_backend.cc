@@ -2,6 +2,7 @@
 #include <catch2/catch_all.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <print>
+#include <random>
 
 using namespace dict;
 
@@ -157,3 +158,88 @@ TEST_CASE("Typst: TeX conversion is also applied in reference entries") {
         "#dictionary-reference([ac’hes], [#lemma[a] \\+ #lemma[c’hes]])"
     );
 }
+
+TEST_CASE("Typst: parallel emission produces the same output") {
+    static constexpr str Input = "c|||c\nb|||\\s{b}\\\\ b2\na > c\nd|||d \\ex \\this\ne > b, d";
+    auto Emit = [](usz threads) {
+        TestOps ops;
+        TypstBackend typ{ops};
+        Generator gen{typ, threads};
+        gen.parse(Input);
+        return gen.emit_to_string();
+    };
+
+    auto serial = Emit(1);
+    CHECK(not serial.has_error);
+    CHECK(Emit(2).backend_output == serial.backend_output);
+    CHECK(Emit(3).backend_output == serial.backend_output);
+    CHECK(Emit(16).backend_output == serial.backend_output);
+}
+
+TEST_CASE("Typst: output is streamed to a sink") {
+    static constexpr str Input = "c|||c\nb|||\\s{b}\\\\ b2\na > c\nd|||d \\ex \\this\ne > b, d";
+    auto Emit = [](str input, usz threads, std::vector<std::string>& chunks) {
+        TestOps ops;
+        TypstBackend typ{ops};
+        Generator gen{typ, threads};
+        gen.parse(input);
+        CallbackSink sink{[&](str chunk) { chunks.push_back(chunk.string()); }};
+        return gen.emit_to(sink);
+    };
+
+    TestOps ops;
+    TypstBackend typ{ops};
+    Generator gen{typ};
+    gen.parse(Input);
+    auto expected = gen.emit_to_string();
+    REQUIRE(not expected.has_error);
+
+    for (usz threads : {1, 3}) {
+        std::vector<std::string> chunks;
+        auto res = Emit(Input, threads, chunks);
+        CHECK(not res.has_error);
+        CHECK(res.backend_output.empty());
+        CHECK(utils::join(chunks, "") == expected.backend_output);
+        if (threads == 1) CHECK(chunks.size() == 5);
+    }
+
+    // With multiple threads, forks are joined and flushed in chunks rather
+    // than all at the end, so they never hold on to all of the output.
+    std::string many;
+    for (usz i = 0; i < 2'000; i++) many += std::format("w{}|||def {}\n", i, i);
+    TypstBackend many_typ{ops};
+    Generator many_gen{many_typ};
+    many_gen.parse(many);
+    auto many_expected = many_gen.emit_to_string();
+    REQUIRE(not many_expected.has_error);
+    {
+        std::vector<std::string> chunks;
+        auto res = Emit(many, 3, chunks);
+        CHECK(not res.has_error);
+        CHECK(utils::join(chunks, "") == many_expected.backend_output);
+        CHECK(chunks.size() > 3);
+    }
+
+    // If there are errors, the entries have already been written; the
+    // errors are returned and also written to the sink so the document
+    // doesn’t compile.
+    std::vector<std::string> chunks;
+    auto res = Emit("a|||\\bogus\nb|||b", 1, chunks);
+    CHECK(res.has_error);
+    CHECK(str(res.backend_output).starts_with("#panic"));
+    REQUIRE(chunks.size() > 1);
+    CHECK(chunks.back() == res.backend_output);
+}
+
+TEST_CASE("Typst: escaping matches str::escape()") {
+    static constexpr str Fragments[]{"a", "text ", "*", "_", "`", "<", "@", "=", "-", "+", "/", "\\", "#", "$", "~", ">", "é"};
+    std::mt19937 rng{42};
+    for (int i = 0; i < 20'000; i++) {
+        std::string s;
+        for (usz n = rng() % 40; n; n--) s += Fragments[rng() % std::size(Fragments)];
+        std::string out;
+        TypstBackend::EscapeMarkup(out, s);
+        INFO("Input: '" << s << "'");
+        CHECK(out == str(s).escape("*_`<@=-+/\\#$"));
+    }
+}